@@ -0,0 +1,1144 @@
+//------------------------------------------------
+//  Ray Tracing & Photon Mapping : benchmarks
+//------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "tracer.h"
+#include "packet.h"
+#include "image.h"
+#include "renderer.h"
+#include "threads.h"
+#include "caustic.h"
+#include "shadow.h"
+#include "wavefront.h"
+
+using std::vector;
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+//--  one measured value, written out with -json
+typedef struct SBenchResult {
+  std::string bench;
+  std::string scene;
+  std::string metric;
+  double      value;
+} SBenchResult;
+
+static vector<SBenchResult> results;
+static int repeats = 3;     //--  timed runs of the macro benchmarks, best one kept
+
+static void
+record(const char *bench, const std::string &scene, const char *metric, double value)
+{
+  SBenchResult r;
+  r.bench  = bench;
+  r.scene  = scene;
+  r.metric = metric;
+  r.value  = value;
+  results.push_back(r);
+}
+
+static bool
+writeJson(const char *path)
+{
+  FILE *fp = fopen(path, "w");
+  if (!fp) return false;
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"real\": \"%s\",\n", sizeof(real) == sizeof(float) ? "float" : "double");
+  fprintf(fp, "  \"simd\": \"%s\",\n", simdName(activeSimdLevel()));
+  fprintf(fp, "  \"threads\": %d,\n", numThreads());
+  fprintf(fp, "  \"repeats\": %d,\n", repeats);
+  fprintf(fp, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const SBenchResult &r = results[i];
+    fprintf(fp, "    {\"bench\": \"%s\", \"scene\": \"%s\", \"metric\": \"%s\", \"value\": %.6g}%s\n",
+        r.bench.c_str(), r.scene.c_str(), r.metric.c_str(), r.value,
+        (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  return fclose(fp) == 0;
+}
+
+//--  diffuse points seen by primary rays on a n x n grid
+static void
+visiblePoints(int n, vector<Vector3> &pnts, vector<SIntersectionStat> &hits)
+{
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      Vector3 ray((x + 0.5) / n - 0.5, -((y + 0.5) / n - 0.5), 1.0);
+      SIntersectionStat istat = raytrace(ray, gOrigin);
+      if (istat.obj == NULL || istat.obj->getOptics() != OPT_NONE) continue;
+      pnts.push_back(gOrigin + ray * istat.dist);
+      hits.push_back(istat);
+    }
+  }
+}
+
+//--  gatherPhotons() : kd-tree vs linear scan of the object's photons
+static void
+benchGather()
+{
+  static const int counts[] = { 500, 2000, 8000, 32000 };
+  vector<Vector3> pnts;
+  vector<SIntersectionStat> hits;
+  visiblePoints(128, pnts, hits);
+
+  printf("%8s %8s %12s %12s %8s %10s\n",
+      "emitted", "stored", "linear[ns]", "kdtree[ns]", "speedup", "max diff");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    nrPhotons = counts[c];
+    emitPhotons();
+
+    int stored = photonStore.size();
+
+    const int n = pnts.size();
+    vector<Vector3> ref(n), kd(n);
+
+    double t0 = now();
+    for (int i = 0; i < n; i++) ref[i] = gatherPhotonsLinear(pnts[i], hits[i]);
+    double t1 = now();
+    for (int i = 0; i < n; i++) kd[i]  = gatherPhotons(pnts[i], hits[i]);
+    double t2 = now();
+
+    double diff = 0.0;
+    for (int i = 0; i < n; i++) diff = std::max(diff, (double)distance(ref[i], kd[i]));
+
+    double ns_linear = (t1 - t0) * 1.0e9 / n;
+    double ns_kdtree = (t2 - t1) * 1.0e9 / n;
+    printf("%8d %8d %12.1f %12.1f %8.2f %10.3g\n",
+        nrPhotons, stored, ns_linear, ns_kdtree, ns_linear / ns_kdtree, diff);
+
+    char scene_name[32];
+    sprintf(scene_name, "room_p%d", nrPhotons);
+    record("gather", scene_name, "ns_linear", ns_linear);
+    record("gather", scene_name, "ns_kdtree", ns_kdtree);
+  }
+}
+
+//--  gatherPhotons() : kd-tree gather vs the nearest precomputed estimate
+static void
+benchIrradiance()
+{
+  static const int counts[] = { 2000, 20000, 100000 };
+  vector<Vector3> pnts;
+  vector<SIntersectionStat> hits;
+  visiblePoints(128, pnts, hits);
+  const int saved_photons = nrPhotons;
+
+  printf("%8s %14s %12s %12s %8s %10s\n",
+      "emitted", "precompute[ms]", "kdtree[ns]", "lookup[ns]", "speedup", "rel err");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    nrPhotons = counts[c];
+    usePrecomputed = false;
+    emitPhotons();
+
+    const int n = pnts.size();
+    vector<Vector3> ref(n), pre(n);
+
+    double t0 = now();
+    for (int i = 0; i < n; i++) ref[i] = gatherPhotons(pnts[i], hits[i]);
+    double t1 = now();
+    usePrecomputed = true;
+    precomputeIrradiance();
+    double t2 = now();
+    for (int i = 0; i < n; i++) pre[i] = gatherPhotons(pnts[i], hits[i]);
+    double t3 = now();
+    usePrecomputed = false;
+    precomputeIrradiance();
+
+    double err = 0.0, sum = 0.0;
+    for (int i = 0; i < n; i++) {
+      for (int k = 0; k < 3; k++) {
+        err += fabs(pre[i][k] - ref[i][k]);
+        sum += fabs(ref[i][k]);
+      }
+    }
+    double ns_kdtree = (t1 - t0) * 1.0e9 / n;
+    double ns_lookup = (t3 - t2) * 1.0e9 / n;
+    double rel_err   = sum > 0.0 ? err / sum : 0.0;
+    printf("%8d %14.3f %12.1f %12.1f %8.2f %10.4f\n",
+        nrPhotons, (t2 - t1) * 1.0e3, ns_kdtree, ns_lookup, ns_kdtree / ns_lookup, rel_err);
+
+    char scene_name[32];
+    sprintf(scene_name, "room_p%d", nrPhotons);
+    record("irradiance", scene_name, "precompute_ms", (t2 - t1) * 1.0e3);
+    record("irradiance", scene_name, "ns_kdtree", ns_kdtree);
+    record("irradiance", scene_name, "ns_lookup", ns_lookup);
+    record("irradiance", scene_name, "rel_err", rel_err);
+  }
+  nrPhotons = saved_photons;
+}
+
+//--  photon samplers : emission time and the error of the gathered
+//--  radiance against many photons of SAMPLER_RANDOM (the legacy cube
+//--  directions are biased : their error does not vanish)
+static void
+benchSampler()
+{
+  static const int counts[] = { 2000, 8000 };
+  static const char *names[SAMPLER_NUM] = { "legacy", "random", "halton" };
+  const int ref_photons = 200000;
+  const int saved_photons = nrPhotons;
+  const int saved_sampler = photonSampler;
+
+  vector<Vector3> pnts;
+  vector<SIntersectionStat> hits;
+  visiblePoints(64, pnts, hits);
+  const int n = pnts.size();
+
+  nrPhotons     = ref_photons;
+  photonSampler = SAMPLER_RANDOM;
+  emitPhotons();
+  vector<Vector3> ref(n);
+  double ref_sum = 0.0;
+  for (int i = 0; i < n; i++) {
+    ref[i] = gatherPhotons(pnts[i], hits[i]);
+    ref_sum += ref[i][0] + ref[i][1] + ref[i][2];
+  }
+
+  printf("%8s %8s %12s %10s\n", "sampler", "emitted", "emit[ms]", "rel err");
+  for (int smp = 0; smp < SAMPLER_NUM; smp++) {
+    for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+      photonSampler = smp;
+      nrPhotons     = counts[c];
+      double best = 1.0e30;
+      for (int r = 0; r < repeats; r++) {
+        double t0 = now();
+        emitPhotons();
+        best = std::min(best, now() - t0);
+      }
+
+      //--  the radiance grows with the photon count
+      const double scale = (double)ref_photons / counts[c];
+      double err = 0.0;
+      for (int i = 0; i < n; i++) {
+        Vector3 e = gatherPhotons(pnts[i], hits[i]) * scale - ref[i];
+        err += fabs(e[0]) + fabs(e[1]) + fabs(e[2]);
+      }
+      err = ref_sum > 0.0 ? err / ref_sum : 0.0;
+
+      printf("%8s %8d %12.3f %10.4f\n", names[smp], counts[c], best * 1.0e3, err);
+      char scene_name[32];
+      sprintf(scene_name, "room_%s_p%d", names[smp], counts[c]);
+      record("sampler", scene_name, "emit_ms", best * 1.0e3);
+      record("sampler", scene_name, "rel_err", err);
+    }
+  }
+
+  nrPhotons     = saved_photons;
+  photonSampler = saved_sampler;
+  emitPhotons();
+}
+
+//--  Russian roulette vs fixed bounces : photon rays, stored photons,
+//--  emission and gather time, and the mean of the gathered radiance
+static void
+benchRoulette()
+{
+  const int photons = 20000;
+  const int  saved_photons  = nrPhotons;
+  const bool saved_roulette = russianRoulette;
+  nrPhotons = photons;
+
+  vector<Vector3> pnts;
+  vector<SIntersectionStat> hits;
+  visiblePoints(128, pnts, hits);
+
+  printf("%10s %12s %10s %12s %12s %10s\n",
+      "", "rays/photon", "stored", "emit[ms]", "gather[ns]", "mean");
+  for (int rr = 0; rr < 2; rr++) {
+    russianRoulette = rr != 0;
+    SStatBlock before, after;
+    statsCollect(before);
+    emitPhotons();
+    statsCollect(after);
+    double rays = (double)(after.count[STAT_RAY_PHOTON] - before.count[STAT_RAY_PHOTON]) / photons;
+
+    double best_emit = 1.0e30;
+    for (int r = 0; r < repeats; r++) {
+      double t0 = now();
+      emitPhotons();
+      best_emit = std::min(best_emit, now() - t0);
+    }
+    double best_gather = 1.0e30;
+    Vector3 sum;
+    for (int r = 0; r < repeats && !pnts.empty(); r++) {
+      sum = Vector3();
+      double t0 = now();
+      for (size_t i = 0; i < pnts.size(); i++) sum += gatherPhotons(pnts[i], hits[i]);
+      best_gather = std::min(best_gather, now() - t0);
+    }
+    double ns_gather = pnts.empty() ? 0.0 : best_gather * 1.0e9 / pnts.size();
+    double mean      = pnts.empty() ? 0.0 : (sum[0] + sum[1] + sum[2]) / (3.0 * pnts.size());
+
+    const char *name = rr ? "roulette" : "fixed";
+    printf("%10s %12.3f %10d %12.3f %12.1f %10.4f\n",
+        name, rays, photonStore.size(), best_emit * 1.0e3, ns_gather, mean);
+    record("roulette", name, "rays_per_photon", rays);
+    record("roulette", name, "stored",          photonStore.size());
+    record("roulette", name, "emit_ms",         best_emit * 1.0e3);
+    record("roulette", name, "ns_per_gather",   ns_gather);
+  }
+
+  nrPhotons       = saved_photons;
+  russianRoulette = saved_roulette;
+  emitPhotons();
+}
+
+//--  caustic photons : uniform emission vs the projection map
+static void
+benchCaustic()
+{
+  const int photons = 20000;
+  const int saved_photons  = nrPhotons;
+  const int saved_caustics = nrCaustics;
+  nrPhotons = photons;
+
+  //--  the caustic photons of a uniform emission are those it leaves out
+  //--  of photonStore once the caustic map is on
+  nrCaustics = 0;
+  double t0 = now();
+  emitPhotons();
+  double t1 = now();
+  const int all = photonStore.size();
+  nrCaustics = photons;
+  emitPhotons();
+  const int uniform = all - photonStore.size();
+
+  double best = 1.0e30;
+  for (int r = 0; r < repeats; r++) {
+    double t2 = now();
+    emitCaustics();
+    best = std::min(best, now() - t2);
+  }
+  const int aimed = causticStore.size();
+
+  printf("%10s %10s %12s %12s\n", "", "emitted", "caustics", "per ms");
+  printf("%10s %10d %12d %12.1f\n", "uniform",    photons, uniform, uniform / ((t1 - t0) * 1.0e3));
+  printf("%10s %10d %12d %12.1f\n", "projection", photons, aimed,   aimed / (best * 1.0e3));
+  printf("projection map : %.1f%% of the directions\n", projectionMap.coverage() * 100.0);
+
+  record("caustic", "room", "uniform_per_ms",    uniform / ((t1 - t0) * 1.0e3));
+  record("caustic", "room", "projection_per_ms", aimed / (best * 1.0e3));
+  record("caustic", "room", "uniform_share",     (double)uniform / photons);
+  record("caustic", "room", "projection_share",  (double)aimed / photons);
+
+  nrPhotons  = saved_photons;
+  nrCaustics = saved_caustics;
+  emitCaustics();
+}
+
+//--  adaptive supersampling vs uniform samples : primary rays and RMS
+//--  error (clamped to [0,1]) against a frame of ref_samples per pixel
+static double
+rmsError(CImage &a, CImage &b)
+{
+  const int n = 3 * a.getWidth() * a.getHeight();
+  const float *pa = a.getData(), *pb = b.getData();
+  double sum = 0.0;
+  for (int i = 0; i < n; i++) {
+    double d = std::min(1.0f, pa[i]) - std::min(1.0f, pb[i]);
+    sum += d * d;
+  }
+  return sqrt(sum / n);
+}
+
+static StatCount
+primaryRays()
+{
+  SStatBlock total;
+  statsCollect(total);
+  return total.count[STAT_RAY_PRIMARY];
+}
+
+static void
+benchAa()
+{
+  const int n           = 64;
+  const int ref_samples = 256;
+  static const int uniform[] = { 4, 16, 64 };
+  static const float thresholds[] = { 0.04, 0.02, 0.01 };
+
+  const int   saved_size    = szImg;
+  const int   saved_base    = aaSamples;
+  const int   saved_max     = aaMaxSamples;
+  const float saved_thresh  = aaThreshold;
+  szImg = n;
+  emitPhotons();
+
+  CImage ref(n, n), img(n, n);
+  aaSamples = aaMaxSamples = ref_samples;
+  renderFrame(ref);
+
+  printf("%10s %8s %12s %12s %10s\n", "", "thresh", "rays/pixel", "frame[ms]", "rmse");
+  for (int k = 0; k < 6; k++) {
+    const bool adaptive = k >= 3;
+    aaSamples    = adaptive ? 4  : uniform[k];
+    aaMaxSamples = adaptive ? 64 : uniform[k];
+    aaThreshold  = adaptive ? thresholds[k - 3] : 0.0f;
+
+    StatCount r0 = primaryRays();
+    double t0 = now();
+    renderFrame(img);
+    double t1 = now();
+    double rays = (double)(primaryRays() - r0) / (n * n);
+    double err  = rmsError(ref, img);
+
+    const char *name = adaptive ? "adaptive" : "uniform";
+    printf("%10s %8.3f %12.2f %12.3f %10.5f\n", name, aaThreshold, rays, (t1 - t0) * 1.0e3, err);
+
+    char scene_name[32];
+    if (adaptive) sprintf(scene_name, "room_adaptive_%g", aaThreshold);
+    else          sprintf(scene_name, "room_uniform_%d", uniform[k]);
+    record("aa", scene_name, "rays_per_pixel", rays);
+    record("aa", scene_name, "rmse",           err);
+  }
+
+  szImg        = saved_size;
+  aaSamples    = saved_base;
+  aaMaxSamples = saved_max;
+  aaThreshold  = saved_thresh;
+}
+
+//--  shadow rays from the light to the visible points : closest hit
+//--  (raytrace() and an object compare) vs the any-hit occluded()
+static void
+benchShadow()
+{
+  static const int counts[] = { 0, 100, 1000, 10000 };
+
+  printf("%8s %12s %12s %8s %12s %12s %10s\n",
+      "objects", "closest[ns]", "anyhit[ns]", "speedup", "tests/ray", "any/ray", "mismatch");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    freeObje();
+    initObje();
+    addRandomSpheres(counts[c], 1);
+
+    vector<Vector3> pnts;
+    vector<SIntersectionStat> hits;
+    visiblePoints(128, pnts, hits);
+    const int n = pnts.size();
+    vector<char> lit_closest(n), lit_any(n);
+
+    double best_closest = 1.0e30, best_any = 1.0e30;
+    double tests_closest = 0.0, tests_any = 0.0;
+    for (int r = 0; r < repeats; r++) {
+      SStatBlock s0, s1, s2;
+      statsCollect(s0);
+      double t0 = now();
+      for (int i = 0; i < n; i++) {
+        SIntersectionStat l = raytrace(pnts[i] - Light, Light);
+        lit_closest[i] = l.obj == hits[i].obj && l.prim == hits[i].prim;
+      }
+      double t1 = now();
+      statsCollect(s1);
+      for (int i = 0; i < n; i++) {
+        //--  as shadePixel() : the own hit, then anything before it
+        Vector3 ray = pnts[i] - Light;
+        int  prim;
+        real dist = rayObject(hits[i].obj, ray, Light, prim);
+        lit_any[i] = dist > 1.0e-5 && dist < NOT_INTERSECTED && prim == hits[i].prim &&
+                     !occluded(ray, Light, dist, hits[i].obj);
+      }
+      double t2 = now();
+      statsCollect(s2);
+      best_closest = std::min(best_closest, t1 - t0);
+      best_any     = std::min(best_any,     t2 - t1);
+      tests_closest = (double)(s1.count[STAT_TEST_SPHERE] + s1.count[STAT_TEST_PLANE]
+                             - s0.count[STAT_TEST_SPHERE] - s0.count[STAT_TEST_PLANE]) / n;
+      tests_any     = (double)(s2.count[STAT_TEST_SPHERE] + s2.count[STAT_TEST_PLANE]
+                             - s1.count[STAT_TEST_SPHERE] - s1.count[STAT_TEST_PLANE]) / n;
+    }
+    int mismatch = 0;
+    for (int i = 0; i < n; i++) mismatch += lit_closest[i] != lit_any[i];
+
+    double ns_closest = best_closest * 1.0e9 / n;
+    double ns_any     = best_any     * 1.0e9 / n;
+    printf("%8d %12.1f %12.1f %8.2f %12.2f %12.2f %10d\n",
+        nrObjects, ns_closest, ns_any, ns_closest / ns_any, tests_closest, tests_any, mismatch);
+
+    char scene_name[32];
+    sprintf(scene_name, "room_%d", counts[c]);
+    record("shadow", scene_name, "ns_closest", ns_closest);
+    record("shadow", scene_name, "ns_anyhit",  ns_any);
+    record("shadow", scene_name, "tests_closest", tests_closest);
+    record("shadow", scene_name, "tests_anyhit",  tests_any);
+  }
+  freeObje();
+  initObje();
+}
+
+//--  direct lighting at the visible points : a shadow ray each vs the
+//--  shadow map, rays only where direct and shadow photons mix; points
+//--  whose light differs from the one of the shadow ray
+static void writeSphereObj(const char *path, int rings, int segments);
+
+//--  light at a visible point as shadePixel() finds it : 0 in shadow
+static bool
+litByRay(const Vector3 &pnt, const SIntersectionStat &hit)
+{
+  Vector3 ray = pnt - Light;
+  int  prim;
+  real dist = rayObject(hit.obj, ray, Light, prim);
+  return dist > 1.0e-5 && dist < NOT_INTERSECTED && prim == hit.prim &&
+         !occluded(ray, Light, dist, hit.obj);
+}
+
+static void
+benchShadowMap()
+{
+  static const int counts[]  = { 0, 100, 1000, -1 };   //--  -1 : a mesh
+  static const int photons[] = { 50000, 200000 };
+  static const char *obj_path = "bench_shadow.obj";
+  const int saved_shadow = nrShadowPhotons;
+
+  printf("%10s %8s %10s %12s %8s %10s %10s\n",
+      "scene", "photons", "build[ms]", "ns/point", "speedup", "skipped", "mismatch");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    freeObje();
+    initObje();
+    char scene_name[32];
+    if (counts[c] >= 0) {
+      addRandomSpheres(counts[c], 1);
+      sprintf(scene_name, "room_%d", counts[c]);
+    } else {
+      static const float center[3] = { -0.7, -1.0, 3.4 };
+      writeSphereObj(obj_path, 128, 256);
+      loadMesh(obj_path, center, 1.0);
+      remove(obj_path);
+      sprintf(scene_name, "room_mesh");
+    }
+
+    vector<Vector3> pnts;
+    vector<SIntersectionStat> hits;
+    visiblePoints(256, pnts, hits);
+    const int n = pnts.size();
+    vector<char> lit_ray(n), lit_map(n);
+
+    double best_ray = 1.0e30;
+    for (int r = 0; r < repeats; r++) {
+      double t0 = now();
+      for (int i = 0; i < n; i++) lit_ray[i] = litByRay(pnts[i], hits[i]);
+      best_ray = std::min(best_ray, now() - t0);
+    }
+    const double ns_ray = best_ray * 1.0e9 / n;
+    printf("%10s %8d %10s %12.1f %8s %10s %10s\n", scene_name, 0, "", ns_ray, "", "", "");
+    record("shadowmap", scene_name, "ns_ray", ns_ray);
+
+    for (unsigned k = 0; k < sizeof(photons) / sizeof(photons[0]); k++) {
+      nrShadowPhotons = photons[k];
+      double t1 = now();
+      emitShadowPhotons();
+      double t2 = now();
+
+      double best = 1.0e30;
+      int skipped = 0;
+      for (int r = 0; r < repeats; r++) {
+        skipped = 0;
+        double t3 = now();
+        for (int i = 0; i < n; i++) {
+          int vis = shadowLookup(pnts[i]);
+          skipped += vis != SHADOW_MIXED;
+          lit_map[i] = vis == SHADOW_MIXED ? litByRay(pnts[i], hits[i]) : vis == SHADOW_LIT;
+        }
+        best = std::min(best, now() - t3);
+      }
+      //--  in shadow or lit facing away : the same ambient light
+      int mismatch = 0;
+      for (int i = 0; i < n; i++) {
+        if (lit_ray[i] == lit_map[i]) continue;
+        mismatch += lightObject(hits[i], pnts[i], 0.1) > 0.1;
+      }
+
+      const double ns = best * 1.0e9 / n;
+      printf("%10s %8d %10.3f %12.1f %8.2f %9.1f%% %10d\n", scene_name, photons[k],
+          (t2 - t1) * 1.0e3, ns, ns_ray / ns, 100.0 * skipped / n, mismatch);
+      char metric[32];
+      sprintf(metric, "ns_%d", photons[k]);
+      record("shadowmap", scene_name, metric, ns);
+      sprintf(metric, "skipped_%d", photons[k]);
+      record("shadowmap", scene_name, metric, (double)skipped / n);
+      sprintf(metric, "mismatch_%d", photons[k]);
+      record("shadowmap", scene_name, metric, mismatch);
+    }
+  }
+
+  nrShadowPhotons = saved_shadow;
+  freeObje();
+  initObje();
+  emitShadowPhotons();
+}
+
+//--  primary visibility : raytrace() per ray vs raytracePacket()
+static void
+benchPrimary()
+{
+  const int n = 512;
+  vector<SIntersectionStat> ref(n * n), hit(n * n);
+
+  double t0 = now();
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) ref[y * n + x] = raytrace(primaryRay(x, y), gOrigin);
+  }
+  double t1 = now();
+  double ns_scalar = (t1 - t0) * 1.0e9 / (n * n);
+
+  printf("%8s %12s %8s %10s\n", "simd", "ns/ray", "speedup", "mismatch");
+  printf("%8s %12.1f %8.2f %10d\n", "raytrace", ns_scalar, 1.0, 0);
+  record("primary", "room", "ns_raytrace", ns_scalar);
+
+  static const int levels[] = { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+  for (unsigned l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+    simdLevel = levels[l];
+    if (activeSimdLevel() != simdLevel) continue;
+
+    SRayPacket rp;
+    double t2 = now();
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x += PACKET_SIZE) {
+        rp.num = PACKET_SIZE;
+        for (int i = 0; i < PACKET_SIZE; i++) setPacketRay(rp, i, primaryRay(x + i, y), gOrigin);
+        raytracePacket(rp, &hit[y * n + x]);
+      }
+    }
+    double t3 = now();
+
+    int mismatch = 0;
+    for (int i = 0; i < n * n; i++) {
+      if (hit[i].obj != ref[i].obj || hit[i].dist != ref[i].dist) mismatch++;
+    }
+    double ns = (t3 - t2) * 1.0e9 / (n * n);
+    printf("%8s %12.1f %8.2f %10d\n", simdName(simdLevel), ns, ns_scalar / ns, mismatch);
+    record("primary", "room", (std::string("ns_packet_") + simdName(simdLevel)).c_str(), ns);
+  }
+  simdLevel = SIMD_AUTO;
+}
+
+//--  primitive tests per ray (sphere and plane tests, lanes of packets too)
+static double
+testsPerRay(const SStatBlock &a, const SStatBlock &b)
+{
+  StatCount rays = 0, tests = 0;
+  for (int c = STAT_RAY_PRIMARY; c <= STAT_RAY_PHOTON; c++) rays += b.count[c] - a.count[c];
+  for (int c = STAT_TEST_SPHERE; c <= STAT_TEST_TRIANGLE; c++) tests += b.count[c] - a.count[c];
+  return rays > 0 ? (double)tests / rays : 0.0;
+}
+
+//--  depth-first vs wavefront (useWavefront) : photon emission and a
+//--  direct lighting frame, with the photons and pixels that differ
+static void
+benchWavefront()
+{
+  static const int counts[] = { 0, 1000 };
+  const int n       = 256;
+  const int photons = 20000;
+
+  const int  saved_size    = szImg;
+  const int  saved_photons = nrPhotons;
+  const bool saved_light   = lightPhotons;
+  szImg     = n;
+  nrPhotons = photons;
+
+  printf("%8s %10s %12s %10s %12s %10s %10s\n",
+      "objects", "", "emit[ms]", "tests/ray", "frame[ms]", "tests/ray", "mismatch");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    freeObje();
+    initObje();
+    addRandomSpheres(counts[c], 1);
+
+    CPhotonStore ref;
+    CImage ref_img(n, n), img(n, n);
+    for (int w = 0; w < 2; w++) {
+      useWavefront = w == 1;
+      SStatBlock s0, s1, s2, s3;
+
+      //--  emitPhotons() : emission and the kd-trees
+      lightPhotons = true;
+      double best_emit = 1.0e30;
+      for (int r = 0; r < repeats; r++) {
+        if (r == 0) statsCollect(s0);
+        double t0 = now();
+        emitPhotons();
+        best_emit = std::min(best_emit, now() - t0);
+        if (r == 0) statsCollect(s1);
+      }
+
+      //--  renderFrame() with direct lighting : the camera paths dominate
+      lightPhotons = false;
+      double best_frame = 1.0e30;
+      for (int r = 0; r < repeats; r++) {
+        if (r == 0) statsCollect(s2);
+        double t0 = now();
+        renderFrame(img);
+        best_frame = std::min(best_frame, now() - t0);
+        if (r == 0) statsCollect(s3);
+      }
+
+      int mismatch = 0;
+      if (w == 0) {
+        ref.append(photonStore, 0, photonStore.size());
+        for (int y = 0; y < n; y++) {
+          for (int x = 0; x < n; x++) ref_img.setPixel(x, y, img.getPixel(x, y));
+        }
+      } else {
+        mismatch = abs(ref.size() - photonStore.size());
+        for (int i = 0; i < std::min(ref.size(), photonStore.size()); i++) {
+          mismatch += memcmp(&ref.pos  [3 * i], &photonStore.pos  [3 * i], 3 * sizeof(float)) != 0 ||
+                      memcmp(&ref.power[3 * i], &photonStore.power[3 * i], 3 * sizeof(float)) != 0;
+        }
+        for (int y = 0; y < n; y++) {
+          for (int x = 0; x < n; x++) mismatch += distance(ref_img.getPixel(x, y), img.getPixel(x, y)) != 0.0;
+        }
+      }
+
+      const char *mode = w ? "wavefront" : "depth";
+      const double emit_tests  = testsPerRay(s0, s1);
+      const double frame_tests = testsPerRay(s2, s3);
+      printf("%8d %10s %12.3f %10.2f %12.3f %10.2f %10d\n", nrObjects, mode,
+          best_emit * 1.0e3, emit_tests, best_frame * 1.0e3, frame_tests, mismatch);
+
+      char scene_name[32];
+      sprintf(scene_name, "room_%d_%s", counts[c], mode);
+      record("wavefront", scene_name, "emit_ms",         best_emit * 1.0e3);
+      record("wavefront", scene_name, "emit_tests_ray",  emit_tests);
+      record("wavefront", scene_name, "frame_ms",        best_frame * 1.0e3);
+      record("wavefront", scene_name, "frame_tests_ray", frame_tests);
+      record("wavefront", scene_name, "mismatch",        mismatch);
+    }
+  }
+  useWavefront = false;
+  freeObje();
+  initObje();
+  szImg        = saved_size;
+  nrPhotons    = saved_photons;
+  lightPhotons = saved_light;
+}
+
+//--  closest hit : linear loop vs BVH on scenes with random spheres
+static void
+benchBvh()
+{
+  static const int counts[] = { 16, 100, 1000, 10000 };
+  const int nrays = 100000;
+
+  printf("%8s %6s %10s %10s %12s %12s %8s %10s\n",
+      "objects", "nodes", "build[ms]", "refit[ms]", "linear[ns]", "bvh[ns]", "speedup", "mismatch");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    freeObje();
+    initObje();
+    double t0 = now();
+    addRandomSpheres(counts[c], 1);
+    double t1 = now();
+    refitAccel();
+    double t2 = now();
+
+    //--  rays from random points in the room to random directions
+    CRandom rng(2, 0);
+    vector<Vector3> org(nrays), dir(nrays);
+    for (int i = 0; i < nrays; i++) {
+      org[i] = Vector3(-1.4 + 2.8 * rng.uniform(), -1.4 + 2.8 * rng.uniform(), 0.1 + 4.8 * rng.uniform());
+      dir[i] = Vector3(rng.uniform() - 0.5, rng.uniform() - 0.5, rng.uniform() - 0.5);
+    }
+
+    vector<SIntersectionStat> ref(nrays), hit(nrays);
+    double t3 = now();
+    for (int i = 0; i < nrays; i++) ref[i] = raytraceLinear(dir[i], org[i]);
+    double t4 = now();
+    for (int i = 0; i < nrays; i++) hit[i] = raytrace(dir[i], org[i]);
+    double t5 = now();
+
+    int mismatch = 0;
+    for (int i = 0; i < nrays; i++) {
+      if (hit[i].obj != ref[i].obj || hit[i].dist != ref[i].dist) mismatch++;
+    }
+    double ns_linear = (t4 - t3) * 1.0e9 / nrays;
+    double ns_bvh    = (t5 - t4) * 1.0e9 / nrays;
+    printf("%8d %6d %10.3f %10.3f %12.1f %12.1f %8.2f %10d\n",
+        nrObjects, sceneBvh.numNodes(), (t1 - t0) * 1.0e3, (t2 - t1) * 1.0e3,
+        ns_linear, ns_bvh, ns_linear / ns_bvh, mismatch);
+
+    char scene_name[32];
+    sprintf(scene_name, "room_%d", counts[c]);
+    record("bvh", scene_name, "build_ms", (t1 - t0) * 1.0e3);
+    record("bvh", scene_name, "refit_ms", (t2 - t1) * 1.0e3);
+    record("bvh", scene_name, "ns_linear", ns_linear);
+    record("bvh", scene_name, "ns_bvh", ns_bvh);
+  }
+  freeObje();
+  initObje();
+}
+
+//--  unit uv sphere written as OBJ (quads), rings x segments x 2 triangles
+static void
+writeSphereObj(const char *path, int rings, int segments)
+{
+  FILE *fp = fopen(path, "w");
+  for (int i = 0; i <= rings; i++) {
+    double th = M_PI * i / rings;
+    for (int j = 0; j < segments; j++) {
+      double ph = 2.0 * M_PI * j / segments;
+      fprintf(fp, "v %f %f %f\n", sin(th) * cos(ph), cos(th), sin(th) * sin(ph));
+    }
+  }
+  for (int i = 0; i < rings; i++) {
+    for (int j = 0; j < segments; j++) {
+      int a = i * segments + j + 1, b = i * segments + (j + 1) % segments + 1;
+      fprintf(fp, "f %d %d %d %d\n", a, b, b + segments, a + segments);
+    }
+  }
+  fclose(fp);
+}
+
+//--  triangle mesh : OBJ parse + BVH build vs mapped .pmesh, hit test per SIMD level
+static void
+benchMesh()
+{
+  static const char *obj_path  = "bench_mesh.obj";
+  static const char *mesh_path = "bench_mesh.pmesh";
+  writeSphereObj(obj_path, 256, 512);
+
+  CMesh *obj = new CMesh();
+  double t0 = now();
+  obj->loadObj(obj_path);
+  double t1 = now();
+  obj->saveBinary(mesh_path);
+  CMesh *bin = new CMesh();
+  double t2 = now();
+  bin->loadBinary(mesh_path);
+  double t3 = now();
+
+  printf("%8s %8s %12s %12s %10s\n", "tris", "nodes", "obj[ms]", "pmesh[ms]", "MB");
+  printf("%8d %8d %12.3f %12.3f %10.2f\n", bin->numTriangles(), bin->numNodes(),
+      (t1 - t0) * 1.0e3, (t3 - t2) * 1.0e3, bin->memoryUsage() / (1024.0 * 1024.0));
+  record("mesh", "uvsphere", "obj_ms", (t1 - t0) * 1.0e3);
+  record("mesh", "uvsphere", "pmesh_ms", (t3 - t2) * 1.0e3);
+
+  //--  rays from a shell around the sphere, aimed near its center
+  const int nrays = 200000;
+  CRandom rng(3, 0);
+  vector<double> org(3 * nrays), dir(3 * nrays);
+  for (int i = 0; i < nrays; i++) {
+    for (int k = 0; k < 3; k++) {
+      org[3 * i + k] = 4.0 * rng.uniform() - 2.0;
+      dir[3 * i + k] = 0.6 * rng.uniform() - 0.3 - org[3 * i + k];
+    }
+  }
+
+  vector<double> ref(nrays), dist(nrays);
+  vector<int>    ref_prim(nrays), prim(nrays);
+  static const int levels[] = { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+  printf("%8s %12s %8s %10s\n", "simd", "ns/ray", "speedup", "mismatch");
+  double ns_scalar = 0.0;
+  for (unsigned l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+    simdLevel = levels[l];
+    if (activeSimdLevel() != simdLevel) continue;
+
+    double t4 = now();
+    for (int i = 0; i < nrays; i++) {
+      dist[i] = bin->intersect(&org[3 * i], &dir[3 * i], 1.0e-5, NOT_INTERSECTED, prim[i]);
+    }
+    double t5 = now();
+    if (simdLevel == SIMD_SCALAR) { ref = dist; ref_prim = prim; }
+
+    int mismatch = 0;
+    for (int i = 0; i < nrays; i++) {
+      if (dist[i] != ref[i] || prim[i] != ref_prim[i]) mismatch++;
+    }
+    double ns = (t5 - t4) * 1.0e9 / nrays;
+    if (simdLevel == SIMD_SCALAR) ns_scalar = ns;
+    printf("%8s %12.1f %8.2f %10d\n", simdName(simdLevel), ns, ns_scalar / ns, mismatch);
+    record("mesh", "uvsphere", (std::string("ns_") + simdName(simdLevel)).c_str(), ns);
+  }
+  simdLevel = SIMD_AUTO;
+
+  delete obj;
+  delete bin;
+  remove(obj_path);
+  remove(mesh_path);
+}
+
+//--  CObj::calc*Intersection() alone, on rays through the room
+static void
+benchIntersect()
+{
+  const int nrays = 1000000;
+  CRandom rng(4, 0);
+  vector<Vector3> org(nrays), dir(nrays);
+  for (int i = 0; i < nrays; i++) {
+    org[i] = Vector3(-1.4 + 2.8 * rng.uniform(), -1.4 + 2.8 * rng.uniform(), 0.1 + 4.8 * rng.uniform());
+    dir[i] = Vector3(rng.uniform() - 0.5, rng.uniform() - 0.5, rng.uniform() - 0.5);
+  }
+
+  CObj *sphere = &objects[scene.sphereObj[0]];
+  CObj *plane  = &objects[scene.planeObj[0]];
+
+  //--  the sums keep the calls alive
+  double best_sphere = 1.0e30, best_plane = 1.0e30, sum = 0.0;
+  for (int r = 0; r < repeats; r++) {
+    double t0 = now();
+    for (int i = 0; i < nrays; i++) sum += sphere->calcSphereIntersection(dir[i], org[i]);
+    double t1 = now();
+    for (int i = 0; i < nrays; i++) sum += plane->calcPlaneIntersection(dir[i], org[i]);
+    double t2 = now();
+    best_sphere = std::min(best_sphere, t1 - t0);
+    best_plane  = std::min(best_plane,  t2 - t1);
+  }
+
+  double ns_sphere = best_sphere * 1.0e9 / nrays;
+  double ns_plane  = best_plane  * 1.0e9 / nrays;
+  printf("%8s %12s %14s\n", "type", "ns/call", "calls/s");
+  printf("%8s %12.2f %14.4g\n", "sphere", ns_sphere, 1.0e9 / ns_sphere);
+  printf("%8s %12.2f %14.4g\n", "plane",  ns_plane,  1.0e9 / ns_plane);
+  if (sum == 0.0) printf("\n");
+  record("intersect", "room", "ns_sphere", ns_sphere);
+  record("intersect", "room", "ns_plane",  ns_plane);
+}
+
+//--  the hot paths end to end on the room with more and more random spheres
+static void
+benchScenes()
+{
+  static const int counts[] = { 0, 100, 1000, 10000 };
+  const int n      = 256;     //--  primary rays and frame size
+  const int photons = 20000;
+
+  const int saved_size    = szImg;
+  const int saved_photons = nrPhotons;
+  szImg     = n;
+  nrPhotons = photons;
+
+  printf("%8s %12s %12s %12s %12s %12s\n",
+      "objects", "rays/s", "emit[ms]", "photons/s", "gather[ns]", "frame[ms]");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    freeObje();
+    initObje();
+    addRandomSpheres(counts[c], 1);
+
+    //--  raytrace() : primary rays, no shading
+    double best_trace = 1.0e30;
+    vector<SIntersectionStat> hit(n * n);
+    for (int r = 0; r < repeats; r++) {
+      double t0 = now();
+      for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) hit[y * n + x] = raytrace(primaryRay(x, y), gOrigin);
+      }
+      best_trace = std::min(best_trace, now() - t0);
+    }
+
+    //--  emitPhotons() : emission, storage and the kd-trees
+    double best_emit = 1.0e30;
+    for (int r = 0; r < repeats; r++) {
+      double t0 = now();
+      emitPhotons();
+      best_emit = std::min(best_emit, now() - t0);
+    }
+    const int stored = photonStore.size();
+
+    //--  gatherPhotons() at the diffuse points of the primary rays
+    vector<Vector3> pnts;
+    vector<SIntersectionStat> hits;
+    visiblePoints(n, pnts, hits);
+    double best_gather = 1.0e30;
+    Vector3 sum;
+    for (int r = 0; r < repeats && !pnts.empty(); r++) {
+      double t0 = now();
+      for (size_t i = 0; i < pnts.size(); i++) sum += gatherPhotons(pnts[i], hits[i]);
+      best_gather = std::min(best_gather, now() - t0);
+    }
+
+    //--  renderFrame() : the whole frame with photon lighting
+    double best_frame = 1.0e30;
+    CImage img(n, n);
+    for (int r = 0; r < repeats; r++) {
+      double t0 = now();
+      renderFrame(img);
+      best_frame = std::min(best_frame, now() - t0);
+    }
+
+    double rays_per_s    = n * n / best_trace;
+    double photons_per_s = photons / best_emit;
+    double ns_gather     = pnts.empty() ? 0.0 : best_gather * 1.0e9 / pnts.size();
+    double frame_ms      = best_frame * 1.0e3;
+    printf("%8d %12.4g %12.3f %12.4g %12.1f %12.3f\n",
+        nrObjects, rays_per_s, best_emit * 1.0e3, photons_per_s, ns_gather, frame_ms);
+    if (sum.isZero() && stored < 0) printf("\n");
+
+    char scene_name[32];
+    sprintf(scene_name, "room_%d", counts[c]);
+    record("raytrace", scene_name, "rays_per_s",    rays_per_s);
+    record("emit",     scene_name, "photons_per_s", photons_per_s);
+    record("emit",     scene_name, "stored",        stored);
+    record("gather",   scene_name, "ns_per_gather", ns_gather);
+    record("frame",    scene_name, "ms",            frame_ms);
+    record("frame",    scene_name, "pixels_per_s",  n * n / best_frame);
+  }
+  freeObje();
+  initObje();
+  szImg     = saved_size;
+  nrPhotons = saved_photons;
+}
+
+//--  refreshPhotons() after a sphere moved vs a full emitPhotons()
+static void
+benchDrag()
+{
+  static const int counts[] = { 0, 100, 1000 };
+  const int steps   = 10;
+  const int photons = 20000;
+
+  const int  saved_photons = nrPhotons;
+  const bool saved_track   = trackPhotonPaths;
+  nrPhotons        = photons;
+  trackPhotonPaths = true;
+
+  printf("%8s %10s %12s %12s %8s %10s\n",
+      "objects", "retraced", "refresh[ms]", "emit[ms]", "speedup", "mismatch");
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    freeObje();
+    initObje();
+    addRandomSpheres(counts[c], 1);
+    emitPhotons();
+
+    //--  the small sphere of the room dragged to the left
+    double t_refresh = 0.0, t_emit = 0.0;
+    long long traced = 0;
+    int mismatch = 0;
+    for (int s = 0; s < steps; s++) {
+      CObj *ob = &objects[0];
+      float bmin[3], bmax[3];
+      ob->getBounds(bmin, bmax);
+      invalidatePhotons(bmin, bmax);
+      ob->setCoord(0, ob->getCoord(0) - 0.02);
+      ob->getBounds(bmin, bmax);
+      invalidatePhotons(bmin, bmax);
+      refitAccel();
+
+      double t0 = now();
+      traced += refreshPhotons();
+      double t1 = now();
+      const int n = photonStore.size();
+      vector<float> pos(photonStore.pos, photonStore.pos + 3 * n);
+      vector<float> power(photonStore.power, photonStore.power + 3 * n);
+      vector<int>   obj(photonStore.obj, photonStore.obj + n);
+
+      double t2 = now();
+      emitPhotons();
+      double t3 = now();
+      t_refresh += t1 - t0;
+      t_emit    += t3 - t2;
+
+      //--  must be the very same photons
+      if (photonStore.size() != n) { mismatch += abs(photonStore.size() - n); continue; }
+      for (int i = 0; i < n; i++) {
+        if (obj[i] != photonStore.obj[i] ||
+            memcmp(&pos[3 * i],   &photonStore.pos[3 * i],   3 * sizeof(float)) ||
+            memcmp(&power[3 * i], &photonStore.power[3 * i], 3 * sizeof(float))) mismatch++;
+      }
+    }
+
+    double retraced = (double)traced / ((double)steps * photons);
+    printf("%8d %9.1f%% %12.3f %12.3f %8.2f %10d\n",
+        nrObjects, retraced * 100.0, t_refresh * 1.0e3 / steps, t_emit * 1.0e3 / steps,
+        t_emit / t_refresh, mismatch);
+
+    char scene_name[32];
+    sprintf(scene_name, "room_%d", counts[c]);
+    record("drag", scene_name, "retraced",   retraced);
+    record("drag", scene_name, "refresh_ms", t_refresh * 1.0e3 / steps);
+    record("drag", scene_name, "emit_ms",    t_emit * 1.0e3 / steps);
+  }
+  freeObje();
+  initObje();
+  nrPhotons        = saved_photons;
+  trackPhotonPaths = saved_track;
+}
+
+typedef struct SBenchSection {
+  const char *name;
+  void      (*run)();
+} SBenchSection;
+
+static const SBenchSection sections[] = {
+  { "intersect", benchIntersect },
+  { "primary",   benchPrimary   },
+  { "shadow",    benchShadow    },
+  { "shadowmap", benchShadowMap },
+  { "gather",    benchGather    },
+  { "irradiance", benchIrradiance },
+  { "roulette",  benchRoulette  },
+  { "sampler",   benchSampler   },
+  { "caustic",   benchCaustic   },
+  { "aa",        benchAa        },
+  { "wavefront", benchWavefront },
+  { "bvh",       benchBvh       },
+  { "mesh",      benchMesh      },
+  { "scenes",    benchScenes    },
+  { "drag",      benchDrag      },
+};
+static const int nrSections = sizeof(sections) / sizeof(sections[0]);
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+      "usage: %s [options] [section ...]\n"
+      "  -json <file> write the results as JSON\n"
+      "  -r <num>     timed runs of the macro benchmarks (default: %d)\n"
+      "  -t <num>     worker threads, 0 : all cores (default: 1)\n"
+      "  sections     ",
+      prog, repeats);
+  for (int i = 0; i < nrSections; i++) fprintf(stderr, "%s ", sections[i].name);
+  fprintf(stderr, "(default: all)\n");
+}
+
+int
+main(int argc, char *argv[]) {
+  const char *json = NULL;
+  vector<const SBenchSection *> run;
+
+  //--  one worker : comparable numbers from machine to machine
+  nrThreads = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    bool  has_val   = (i + 1 < argc);
+    if      (!strcmp(opt, "-json") && has_val) { json = argv[++i]; }
+    else if (!strcmp(opt, "-r") && has_val)    { repeats   = std::max(1, atoi(argv[++i])); }
+    else if (!strcmp(opt, "-t") && has_val)    { nrThreads = atoi(argv[++i]); }
+    else {
+      int k = 0;
+      while (k < nrSections && strcmp(opt, sections[k].name)) k++;
+      if (k == nrSections) { usage(argv[0]); return 1; }
+      run.push_back(&sections[k]);
+    }
+  }
+  if (run.empty()) {
+    for (int k = 0; k < nrSections; k++) run.push_back(&sections[k]);
+  }
+
+  initObje();
+  for (size_t k = 0; k < run.size(); k++) {
+    printf("== %s\n", run[k]->name);
+    run[k]->run();
+  }
+  freeObje();
+
+  if (json && !writeJson(json)) {
+    fprintf(stderr, "cannot write %s\n", json);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+
+#include "bvh.h"
+
+//--  SAH parameters
+static const int   bvh_bins      = 12;
+static const int   bvh_leaf_size = 2;    //--  always a leaf at this size (times width)
+static const int   bvh_max_leaf  = 8;    //--  SAH may stop splitting up to this size (times width)
+static const int   bvh_max_depth = 48;   //--  traversal stack is 64 deep
+static const float bvh_cost_node = 1.0f; //--  traversal cost relative to one primitive test
+
+void
+setBvhRay(SBvhRay &br, const double *org, const double *dir)
+{
+  for (int k = 0; k < 3; k++) {
+    br.org [k] = org[k];
+    br.flat[k] = (dir[k] == 0.0);
+    br.inv [k] = br.flat[k] ? 0.0 : 1.0 / dir[k];
+  }
+}
+
+//--  intersection cost of count primitives tested width at a time
+static inline float
+leafCost(int count, int width)
+{
+  return (count + width - 1) / width;
+}
+
+//--  growable box
+typedef struct SBox {
+  float bmin[3];
+  float bmax[3];
+  SBox() {
+    for (int k = 0; k < 3; k++) { bmin[k] = 1.0e30f; bmax[k] = -1.0e30f; }
+  }
+  void grow(const float *mn, const float *mx) {
+    for (int k = 0; k < 3; k++) {
+      bmin[k] = std::min(bmin[k], mn[k]);
+      bmax[k] = std::max(bmax[k], mx[k]);
+    }
+  }
+  float area() const {
+    float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+    if (dx < 0.0f) return 0.0f;
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+  }
+} SBox;
+
+void
+CBvh::build(int n, const float *pmin, const float *pmax, int width)
+{
+  clear();
+  prims.resize(n);
+  if (n == 0) return;
+
+  std::vector<float> cent(3 * n);
+  for (int i = 0; i < n; i++) {
+    prims[i] = i;
+    for (int k = 0; k < 3; k++) cent[3 * i + k] = 0.5f * (pmin[3 * i + k] + pmax[3 * i + k]);
+  }
+  store.reserve(2 * n);
+  buildNode(0, n, pmin, pmax, cent, 0, std::max(1, width));
+  nodes  = &store[0];
+  nnodes = store.size();
+}
+
+bool
+CBvh::attach(const SBvhNode *nd, int num, int nprims)
+{
+  clear();
+  //--  depth first : both children after their parent, every node but the
+  //--  root the child of exactly one, no deeper than the traversal stack
+  //--  (-1 : no parent yet)
+  std::vector<int> depth(num, -1);
+  if (num > 0) depth[0] = 0;
+  for (int i = 0; i < num; i++) {
+    const SBvhNode &node = nd[i];
+    if (depth[i] < 0 || depth[i] > bvh_max_depth) return false;
+    if (node.count > 0) {
+      if (node.offset < 0 || node.offset > nprims - node.count) return false;
+      continue;
+    }
+    const int l = i + 1, r = node.offset;
+    if (node.count < 0 || r <= l || r >= num) return false;
+    if (depth[l] >= 0 || depth[r] >= 0) return false;
+    depth[l] = depth[r] = depth[i] + 1;
+  }
+  nodes  = nd;
+  nnodes = num;
+  return true;
+}
+
+int
+CBvh::buildNode(int start, int end, const float *pmin, const float *pmax,
+                const std::vector<float> &cent, int depth, int width)
+{
+  int index = store.size();
+  store.push_back(SBvhNode());
+
+  SBox box, cbox;
+  for (int i = start; i < end; i++) {
+    int p = prims[i];
+    box .grow(&pmin[3 * p], &pmax[3 * p]);
+    cbox.grow(&cent[3 * p], &cent[3 * p]);
+  }
+  for (int k = 0; k < 3; k++) {
+    store[index].bmin[k] = box.bmin[k];
+    store[index].bmax[k] = box.bmax[k];
+  }
+
+  const int count = end - start;
+  int   best_axis = -1, best_bin = 0;
+  float best_cost = leafCost(count, width);
+
+  if (count > bvh_leaf_size * width && depth < bvh_max_depth) {
+    //--  binned SAH on centroids
+    for (int axis = 0; axis < 3; axis++) {
+      float lo = cbox.bmin[axis], ext = cbox.bmax[axis] - lo;
+      if (ext <= 0.0f) continue;
+
+      SBox bins[bvh_bins];
+      int  cnt [bvh_bins] = {0};
+      for (int i = start; i < end; i++) {
+        int p = prims[i];
+        int b = std::min(bvh_bins - 1, (int)(bvh_bins * (cent[3 * p + axis] - lo) / ext));
+        cnt[b]++;
+        bins[b].grow(&pmin[3 * p], &pmax[3 * p]);
+      }
+
+      //--  sweep from the right, then evaluate every split from the left
+      float right_area[bvh_bins];
+      int   right_cnt [bvh_bins];
+      SBox  acc;
+      int   n = 0;
+      for (int b = bvh_bins - 1; b > 0; b--) {
+        acc.grow(bins[b].bmin, bins[b].bmax);
+        n += cnt[b];
+        right_area[b] = acc.area();
+        right_cnt [b] = n;
+      }
+      SBox left;
+      n = 0;
+      for (int b = 0; b < bvh_bins - 1; b++) {
+        left.grow(bins[b].bmin, bins[b].bmax);
+        n += cnt[b];
+        if (n == 0 || right_cnt[b + 1] == 0) continue;
+        float cost = bvh_cost_node +
+          (left.area() * leafCost(n, width) + right_area[b + 1] * leafCost(right_cnt[b + 1], width)) / box.area();
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin  = b;
+        }
+      }
+    }
+  }
+
+  int mid = -1;
+  if (best_axis >= 0) {
+    float lo = cbox.bmin[best_axis], ext = cbox.bmax[best_axis] - lo;
+    int  *it = std::partition(&prims[start], &prims[0] + end, [&](int p) {
+      int b = std::min(bvh_bins - 1, (int)(bvh_bins * (cent[3 * p + best_axis] - lo) / ext));
+      return b <= best_bin;
+    });
+    mid = it - &prims[0];
+  } else if (count > bvh_max_leaf * width && depth < bvh_max_depth) {
+    //--  SAH prefers a leaf (or cannot split) but the leaf would be too big
+    mid = start + count / 2;
+  }
+
+  if (mid <= start || mid >= end) {
+    store[index].offset = start;
+    store[index].count  = count;
+    return index;
+  }
+
+  buildNode(start, mid, pmin, pmax, cent, depth + 1, width);
+  int right = buildNode(mid, end, pmin, pmax, cent, depth + 1, width);
+  store[index].offset = right;
+  store[index].count  = 0;
+  return index;
+}
+
+void
+CBvh::refit(const float *pmin, const float *pmax)
+{
+  //--  attached nodes are read only
+  if (store.empty()) return;
+
+  //--  children always come after their parent : walk backwards
+  for (int i = (int)store.size() - 1; i >= 0; i--) {
+    SBvhNode &nd = store[i];
+    SBox box;
+    if (nd.count > 0) {
+      for (int j = 0; j < nd.count; j++) {
+        int p = prims[nd.offset + j];
+        box.grow(&pmin[3 * p], &pmax[3 * p]);
+      }
+    } else {
+      box.grow(store[i + 1].bmin,    store[i + 1].bmax);
+      box.grow(store[nd.offset].bmin, store[nd.offset].bmax);
+    }
+    for (int k = 0; k < 3; k++) {
+      nd.bmin[k] = box.bmin[k];
+      nd.bmax[k] = box.bmax[k];
+    }
+  }
+}
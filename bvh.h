@@ -0,0 +1,192 @@
+//bvh.h
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include <algorithm>
+
+//--  flattened node, two per cache line
+//--  interior : children are (this + 1) and offset, count == 0
+//--  leaf     : prims[offset .. offset + count)
+typedef struct SBvhNode {
+  float bmin[3];
+  int   offset;
+  float bmax[3];
+  int   count;
+} SBvhNode;
+
+//--  ray with the reciprocal direction used by the slab test
+typedef struct SBvhRay {
+  double org[3];
+  double inv[3];
+  bool   flat[3];     //--  direction component is 0 : slab test by containment
+} SBvhRay;
+
+void setBvhRay(SBvhRay &br, const double *org, const double *dir);
+
+//--  slab test against a node box : entry distance in tnear if the box is
+//--  hit in front of the origin no farther than tmax
+inline bool
+hitBvhNode(const SBvhNode &nd, const SBvhRay &br, double tmax, double &tnear)
+{
+  double t0 = -1.0e300, t1 = tmax;
+  for (int k = 0; k < 3; k++) {
+    if (br.flat[k]) {
+      if (br.org[k] < nd.bmin[k] || br.org[k] > nd.bmax[k]) return false;
+      continue;
+    }
+    double ta = (nd.bmin[k] - br.org[k]) * br.inv[k];
+    double tb = (nd.bmax[k] - br.org[k]) * br.inv[k];
+    t0 = std::max(t0, std::min(ta, tb));
+    t1 = std::min(t1, std::max(ta, tb));
+  }
+  //--  missed, or whole box behind the origin
+  if (t0 > t1 || t1 < 0.0) return false;
+  tnear = t0;
+  return true;
+}
+
+//--  bounding volume hierarchy over primitive boxes, built with binned SAH
+class CBvh {
+  public :
+    CBvh() : nodes(NULL), nnodes(0) {}
+
+    //--  n boxes, pmin/pmax : 3 floats per primitive
+    //--  width : primitives a leaf tests at once (SIMD lanes), for the SAH cost
+    void    build(int n, const float *pmin, const float *pmax, int width = 1);
+    //--  same primitives with new boxes : keeps the topology
+    void    refit(const float *pmin, const float *pmax);
+    //--  nodes kept elsewhere (e.g. a mapped file), not copied
+    //--  leaves index the primitives directly : prim(i) == i
+    //--  false (and empty) unless the nodes are a tree as build() lays it
+    //--  out, with leaves within nprims primitives
+    bool    attach(const SBvhNode *nd, int num, int nprims);
+    void    clear() { store.clear(); prims.clear(); nodes = NULL; nnodes = 0; }
+
+    bool    empty()    const { return nnodes == 0; }
+    int     numNodes() const { return nnodes; }
+    const SBvhNode &node(int i) const { return nodes[i]; }
+    const SBvhNode *nodeData()  const { return nodes; }
+    int     prim(int i) const { return prims.empty() ? i : prims[i]; }
+    //--  build order of the primitives : leaf ranges index into it
+    const int *primOrder() const { return prims.empty() ? NULL : &prims[0]; }
+
+    //--  q.tmax() : current closest distance, q.test(prim) : intersect primitive
+    //--  (q.done() : stop traversal, for any-hit queries)
+    template <class Query>
+    void    intersect(const SBvhRay &br, Query &q) const;
+    //--  same traversal, q.testLeaf(first, count) gets whole leaf ranges
+    template <class Query>
+    void    intersectLeaves(const SBvhRay &br, Query &q) const;
+
+    //--  q.test(prim) for every primitive whose box contains p
+    template <class Query>
+    void    contain(const double *p, Query &q) const;
+
+  private :
+    //--  nodes may point into store : not copyable
+    CBvh(const CBvh &);
+    CBvh &operator =(const CBvh &);
+
+    int     buildNode(int start, int end, const float *pmin, const float *pmax,
+                      const std::vector<float> &cent, int depth, int width);
+
+    std::vector<SBvhNode> store;    //--  owned nodes (build)
+    std::vector<int>      prims;
+    const SBvhNode       *nodes;    //--  store or attached memory
+    int                   nnodes;
+};
+
+//--  per primitive query on top of CBvh::intersectLeaves()
+template <class Query>
+struct SBvhPrimQuery {
+  const CBvh &bvh;
+  Query      &q;
+  SBvhPrimQuery(const CBvh &b, Query &qu) : bvh(b), q(qu) {}
+
+  double tmax() const { return q.tmax(); }
+  bool   done() const { return q.done(); }
+  void   testLeaf(int first, int count) {
+    for (int i = 0; i < count && !q.done(); i++) q.test(bvh.prim(first + i));
+  }
+};
+
+template <class Query> void
+CBvh::intersect(const SBvhRay &br, Query &q) const
+{
+  SBvhPrimQuery<Query> pq(*this, q);
+  intersectLeaves(br, pq);
+}
+
+template <class Query> void
+CBvh::intersectLeaves(const SBvhRay &br, Query &q) const
+{
+  if (nnodes == 0) return;
+
+  double tnear;
+  if (!hitBvhNode(nodes[0], br, q.tmax(), tnear)) return;
+
+  int    stack[64];
+  double stackT[64];
+  int    sp   = 0;
+  int    node = 0;
+
+  while (true) {
+    const SBvhNode &nd = nodes[node];
+    if (nd.count > 0) {
+      q.testLeaf(nd.offset, nd.count);
+      if (q.done()) return;
+    } else {
+      //--  nearer child first, the other one waits on the stack
+      int    l = node + 1, r = nd.offset;
+      double tl, tr;
+      bool   hl = hitBvhNode(nodes[l], br, q.tmax(), tl);
+      bool   hr = hitBvhNode(nodes[r], br, q.tmax(), tr);
+      if (hl && hr) {
+        if (tl <= tr) { stack[sp] = r; stackT[sp++] = tr; node = l; }
+        else          { stack[sp] = l; stackT[sp++] = tl; node = r; }
+        continue;
+      }
+      if (hl) { node = l; continue; }
+      if (hr) { node = r; continue; }
+    }
+
+    //--  pop, skipping nodes beyond a hit found meanwhile
+    do {
+      if (sp == 0) return;
+      --sp;
+    } while (stackT[sp] > q.tmax());
+    node = stack[sp];
+  }
+}
+
+template <class Query> void
+CBvh::contain(const double *p, Query &q) const
+{
+  if (nnodes == 0) return;
+
+  int stack[64];
+  int sp   = 0;
+  int node = 0;
+
+  while (true) {
+    const SBvhNode &nd = nodes[node];
+    bool inside = true;
+    for (int k = 0; k < 3; k++) {
+      if (p[k] < nd.bmin[k] || p[k] > nd.bmax[k]) inside = false;
+    }
+    if (inside) {
+      if (nd.count > 0) {
+        for (int i = 0; i < nd.count; i++) q.test(prim(nd.offset + i));
+      } else {
+        stack[sp++] = nd.offset;
+        node = node + 1;
+        continue;
+      }
+    }
+    if (sp == 0) return;
+    node = stack[--sp];
+  }
+}
+
+#endif // __BVH_H__
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tracer.h"
+#include "caustic.h"
+#include "threads.h"
+
+int   nrCaustics    = 0;     //--  Number of Caustic Photons (0 : no caustic map)
+float causticRadius = 0.15;  //--  Caustic Gather Radius (a distance)
+
+CPhotonStore causticStore;
+std::vector<CPhotonMap> causticMaps;
+CProjectionMap projectionMap;
+
+//--  bounding spheres of the specular objects (x, y, z, radius)
+static std::vector<float> targets;
+
+//--------------------
+//  Projection Map
+//--------------------
+
+void
+CProjectionMap::cellDir(int face, double u, double v, double *d) const
+{
+  const int axis = face / 2;
+  d[axis]           = (face & 1) ? -1.0 : 1.0;
+  d[(axis + 1) % 3] = u;
+  d[(axis + 2) % 3] = v;
+  double len = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  for (int k = 0; k < 3; k++) d[k] /= len;
+}
+
+int
+CProjectionMap::cell(const Vector3 &dir) const
+{
+  int axis = 0;
+  if (fabs(dir[1]) > fabs(dir[axis])) axis = 1;
+  if (fabs(dir[2]) > fabs(dir[axis])) axis = 2;
+  const double a = fabs(dir[axis]);
+  const int face = 2 * axis + (dir[axis] < 0.0 ? 1 : 0);
+
+  double u = dir[(axis + 1) % 3] / a;
+  double v = dir[(axis + 2) % 3] / a;
+  int iu = std::max(0, std::min(res - 1, (int)((u + 1.0) * 0.5 * res)));
+  int iv = std::max(0, std::min(res - 1, (int)((v + 1.0) * 0.5 * res)));
+  return (face * res + iv) * res + iu;
+}
+
+static double
+angleBetween(const double *a, const double *b)
+{
+  double c = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+  return acos(std::max(-1.0, std::min(1.0, c)));
+}
+
+void
+CProjectionMap::build(const Vector3 &light, float spread, const std::vector<float> &spheres, int r)
+{
+  res     = r;
+  flagged = 0;
+  cells.assign(6 * res * res, 0);
+
+  const double step = 2.0 / res;
+  for (int face = 0; face < 6; face++) {
+    for (int iv = 0; iv < res; iv++) {
+      for (int iu = 0; iu < res; iu++) {
+        //--  cone around the cell center through its corners
+        double c[3], d[3];
+        double u0 = -1.0 + iu * step, v0 = -1.0 + iv * step;
+        cellDir(face, u0 + 0.5 * step, v0 + 0.5 * step, c);
+        double half = 0.0;
+        for (int k = 0; k < 4; k++) {
+          cellDir(face, u0 + (k & 1) * step, v0 + (k >> 1) * step, d);
+          half = std::max(half, angleBetween(c, d));
+        }
+
+        bool hit = false;
+        for (size_t s = 0; s + 3 < spheres.size() && !hit; s += 4) {
+          double L[3] = { spheres[s] - light[0], spheres[s + 1] - light[1], spheres[s + 2] - light[2] };
+          double dist = sqrt(L[0] * L[0] + L[1] * L[1] + L[2] * L[2]);
+          double rad  = spheres[s + 3] + spread;
+          //--  rays from a point within spread of the light are within rad
+          //--  of the ray from the light : close spheres take every direction
+          if (dist * dist <= spread * spread + rad * rad) { hit = true; break; }
+          for (int k = 0; k < 3; k++) L[k] /= dist;
+          hit = angleBetween(c, L) <= asin(rad / dist) + half + 1.0e-3;
+        }
+        if (hit) {
+          cells[(face * res + iv) * res + iu] = 1;
+          flagged++;
+        }
+      }
+    }
+  }
+}
+
+//--------------------
+//  Caustic Photons
+//--------------------
+
+//--  ray of a photon meets a target (padded : the hit test is in float)
+static bool
+hitsTarget(const Vector3 &from, const Vector3 &ray)
+{
+  for (size_t s = 0; s < targets.size(); s += 4) {
+    double sx = targets[s] - from[0], sy = targets[s + 1] - from[1], sz = targets[s + 2] - from[2];
+    double r  = targets[s + 3] * 1.001 + 1.0e-4;
+    double b  = sx * ray[0] + sy * ray[1] + sz * ray[2];
+    double s2 = sx * sx + sy * sy + sz * sz;
+    if (s2 <= r * r) return true;
+    if (b > 0.0 && s2 - b * b <= r * r) return true;
+  }
+  return false;
+}
+
+//--  candidates drawn like emitPhoton() until one may hit a target,
+//--  then its path through mirrors and glass to the first diffuse surface
+//--  returns the candidates drawn
+static const int max_tries = 1 << 20;
+
+static int
+emitCaustic(CSampler &smp, CPhotonStore &st, std::vector<float> *)
+{
+  Vector3 from, ray;
+  int tries = 0;
+  while (true) {
+    if (tries >= max_tries) return tries;
+    tries++;
+    if (!startPhoton(smp, from, ray)) continue;
+    if (!projectionMap.test(ray) || !hitsTarget(from, ray)) continue;
+    break;
+  }
+  statAdd(STAT_PHOTON_EMITTED);
+
+  statAdd(STAT_RAY_PHOTON);
+  SIntersectionStat istat = raytrace(ray, from);
+  if (istat.dist >= NOT_INTERSECTED || istat.obj->getOptics() == OPT_NONE) return tries;
+
+  //--  reflect or refract, as in emitPhoton()
+  float refractive = 1.0;
+  Vector3 pnt = from + ray * istat.dist;
+  int ref = 0;
+  while (istat.obj->getOptics() != OPT_NONE && ref < reflection_limit){
+    if(istat.obj->getOptics() == OPT_REFLECT) { ray = reflect(istat, pnt, ray, from); }
+    else                       /*OPT_REFRACT*/{ ray = refract(istat, pnt, ray, from, refractive); }
+    ref++;
+
+    from = pnt;
+    statAdd(STAT_RAY_PHOTON);
+    istat = raytrace(ray, from);
+    if (istat.dist >= NOT_INTERSECTED) return tries;
+    pnt = from + ray * istat.dist;
+  }
+
+  Vector3 white(1.0, 1.0, 1.0);
+  storePhoton(st, istat.obj, pnt, ray, mulColor(white, istat.obj));
+  return tries;
+}
+
+void
+emitCaustics()
+{
+  causticStore.clear();
+  causticMaps.clear();
+  if (nrCaustics <= 0) return;
+  StatCount t0 = statClock();
+
+  //--  spheres as they are, other objects by the sphere around their box
+  targets.clear();
+  for (int id = 0; id < nrObjects; id++) {
+    CObj &ob = objects[id];
+    if (ob.getOptics() == OPT_NONE) continue;
+    float mn[3], mx[3];
+    if (ob.getType() == TYPE_SPHERE) {
+      for (int k = 0; k < 4; k++) targets.push_back(ob.getCoord(k));
+    } else if (ob.getBounds(mn, mx)) {
+      float r2 = 0.0f;
+      for (int k = 0; k < 3; k++) {
+        targets.push_back(0.5f * (mn[k] + mx[k]));
+        r2 += 0.25f * (mx[k] - mn[k]) * (mx[k] - mn[k]);
+      }
+      targets.push_back(sqrt(r2));
+    } else {
+      //--  unbounded mirror : every direction
+      for (int k = 0; k < 3; k++) targets.push_back(Light[k]);
+      targets.push_back(1.0e30f);
+    }
+  }
+  projectionMap.build(Light, lightRadius, targets, 64);
+
+  long long tries = 0;
+  if (projectionMap.coverage() > 0.0f) {
+    //--  streams apart from those of emitPhotons(); candidates are drawn
+    //--  until one is aimed right : a random stream, no Halton point
+    int type = photonSampler == SAMPLER_HALTON ? SAMPLER_RANDOM : photonSampler;
+    tries = emitPhotonsInto(causticStore, emitCaustic, type, stream_caustic, nrCaustics);
+    statAdd(STAT_PHOTON_STORED, causticStore.size());
+  }
+
+  //--  every candidate stands for one photon of emitPhotons() : the
+  //--  caustic photons share the power of those that would have hit
+  if (tries > 0) {
+    const float scale = (float)((double)(int)(nrPhotons * photonScale) / tries);
+    for (int i = 0; i < 3 * causticStore.size(); i++) causticStore.power[i] *= scale;
+  }
+  statAdd(STAT_TIME_EMIT, statClock() - t0);
+
+  t0 = statClock();
+  causticStore.sortByObject(nrObjects);
+  causticMaps.resize(nrObjects);
+  for (int id = 0; id < nrObjects; id++) {
+    causticMaps[id].build(&causticStore,
+        causticStore.rangeBegin(id), causticStore.rangeEnd(id), numThreads());
+  }
+  statAdd(STAT_TIME_PHOTONMAP, statClock() - t0);
+}
+
+//--  the cone filter of gatherPhotons() shrunk to causticRadius : same
+//--  integral over the disk, so the two maps add up
+typedef struct SCausticGather {
+  Vector3 N;
+  Vector3 energy;
+  double  shrink;     //--  sqRadius / causticRadius
+  void operator ()(int i, double dist) {
+    const float *d = &causticStore.dir[3 * i];
+    float weight = std::max(0.0f, -(float)(N[0] * d[0] + N[1] * d[1] + N[2] * d[2]));
+    weight *= (1.0 - dist * shrink) * shrink * shrink / exposure;
+    energy += Vector3(&causticStore.power[3 * i]) * weight;
+  }
+} SCausticGather;
+
+Vector3
+gatherCaustics(const Vector3 &p, const Vector3 &N, int id)
+{
+  if (id >= (int)causticMaps.size()) return Vector3();
+  SCausticGather gather;
+  gather.N      = N;
+  gather.shrink = sqRadius / causticRadius;
+  causticMaps[id].locate(p, causticRadius, gather);
+  return gather.energy;
+}
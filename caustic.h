@@ -0,0 +1,47 @@
+//caustic.h
+#ifndef __CAUSTIC_H__
+#define __CAUSTIC_H__
+
+#include <vector>
+#include "photonmap.h"
+
+extern int   nrCaustics;    //--  Number of Caustic Photons (0 : no caustic map)
+extern float causticRadius; //--  Caustic Gather Radius (a distance)
+
+//--  photons that reached a diffuse surface through mirrors and glass only,
+//--  contiguous per object, power scaled to the photons of emitPhotons()
+extern CPhotonStore causticStore;
+extern std::vector<CPhotonMap> causticMaps;
+
+//--  directions from the light that can reach a specular object
+//--  (Jensen's projection map), cells on the 6 faces of a cube
+class CProjectionMap {
+  public :
+    CProjectionMap() : res(0), flagged(0) {}
+
+    //--  cells whose cone of directions, from any point within spread of
+    //--  light, meets one of the spheres (x, y, z, radius)
+    void    build(const Vector3 &light, float spread, const std::vector<float> &spheres, int res);
+    bool    test(const Vector3 &dir) const { return cells[cell(dir)] != 0; }
+    //--  share of the cells flagged
+    float   coverage() const { return cells.empty() ? 0.0f : (float)flagged / cells.size(); }
+
+  private :
+    int     cell(const Vector3 &dir) const;
+    void    cellDir(int face, double u, double v, double *d) const;
+
+    int     res;
+    int     flagged;
+    std::vector<unsigned char> cells;
+};
+
+extern CProjectionMap projectionMap;
+
+//--  nrCaustics photons aimed at the specular objects through projectionMap
+//--  into causticStore; the first diffuse hits after mirrors and glass are
+//--  left out of photonStore while nrCaustics > 0 (see emitPhoton())
+void    emitCaustics();
+//--  caustic radiance at p on object id, like gatherPhotons()
+Vector3 gatherCaustics(const Vector3 &p, const Vector3 &N, int id);
+
+#endif // __CAUSTIC_H__
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <string>
+#include <algorithm>
+
+#include "costmap.h"
+#include "image.h"
+
+CCostMap::CCostMap(int w, int h)
+  : width(w), height(h), data(w * h * COST_NUM, 0.0f)
+{
+}
+
+void
+CCostMap::clear()
+{
+  std::fill(data.begin(), data.end(), 0.0f);
+}
+
+float
+CCostMap::maxValue(int c) const
+{
+  float mx = 0.0f;
+  for (int i = c; i < (int)data.size(); i += COST_NUM) mx = std::max(mx, data[i]);
+  return mx;
+}
+
+float
+CCostMap::meanValue(int c) const
+{
+  double sum = 0.0;
+  for (int i = c; i < (int)data.size(); i += COST_NUM) sum += data[i];
+  return (width * height > 0) ? sum / (width * height) : 0.0f;
+}
+
+const char *
+CCostMap::channelName(int c)
+{
+  switch (c) {
+    case COST_CYCLES  : return "cycles";
+    case COST_RAYS    : return "rays";
+    case COST_DEPTH   : return "depth";
+    case COST_PHOTONS : return "photons";
+  }
+  return "";
+}
+
+bool
+CCostMap::writeRaw(const char *path, int c) const
+{
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  //--  one channel, little endian, bottom to top like CImage::writePFM()
+  fprintf(fp, "Pf\n%d %d\n-1.0\n", width, height);
+  std::vector<float> line(width);
+  for (int y = height - 1; y >= 0; y--) {
+    for (int x = 0; x < width; x++) line[x] = get(x, y, c);
+    fwrite(&line[0], sizeof(float), width, fp);
+  }
+  return fclose(fp) == 0;
+}
+
+bool
+CCostMap::writeFalseColor(const char *path, int c) const
+{
+  //--  piecewise linear, at 0, 1/4, 1/2, 3/4 and 1 of the maximum
+  static const float ramp[5][3] = {
+    { 0.0f, 0.0f, 0.0f },
+    { 0.0f, 0.0f, 1.0f },
+    { 1.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 0.0f },
+    { 1.0f, 1.0f, 1.0f },
+  };
+  //--  a few interrupted pixels must not turn the rest black
+  std::vector<float> sorted;
+  for (int i = c; i < (int)data.size(); i += COST_NUM) sorted.push_back(data[i]);
+  std::sort(sorted.begin(), sorted.end());
+  const float mx = sorted.empty() ? 0.0f : sorted[(sorted.size() - 1) * 99 / 100];
+
+  CImage img(width, height);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      float t = (mx > 0.0f) ? std::min(get(x, y, c) / mx, 1.0f) * 4.0f : 0.0f;
+      int   k = std::min((int)t, 3);
+      float f = t - k;
+      img.setPixel(x, y, Vector3(
+          ramp[k][0] + (ramp[k + 1][0] - ramp[k][0]) * f,
+          ramp[k][1] + (ramp[k + 1][1] - ramp[k][1]) * f,
+          ramp[k][2] + (ramp[k + 1][2] - ramp[k][2]) * f));
+    }
+  }
+  return img.writePPM(path);
+}
+
+bool
+CCostMap::write(const char *prefix) const
+{
+  bool ok = true;
+  for (int c = 0; c < COST_NUM; c++) {
+    std::string base = std::string(prefix) + "_" + channelName(c);
+    ok = writeRaw((base + ".pfm").c_str(), c) && ok;
+    ok = writeFalseColor((base + ".ppm").c_str(), c) && ok;
+  }
+  return ok;
+}
@@ -0,0 +1,48 @@
+//costmap.h
+#ifndef __COSTMAP_H__
+#define __COSTMAP_H__
+
+#include <vector>
+
+//--  what a pixel of calcPixelColor() cost
+enum {
+  COST_CYCLES = 0,    //--  time stamp counter
+  COST_RAYS,          //--  raytrace() calls (primary, reflect, refract, shadow)
+  COST_DEPTH,         //--  reflections and refractions followed, up to reflection_limit
+  COST_PHOTONS,       //--  photons visited by gatherPhotons()
+  COST_NUM
+};
+
+//--  per pixel costs of a frame, COST_NUM floats per pixel (row 0 = top)
+//--  rays, depth and photons come from the stats counters : zero with NO_STATS
+class CCostMap {
+  public :
+    CCostMap(int w, int h);
+
+    int     getWidth()  const { return width; }
+    int     getHeight() const { return height; }
+    float   get(int x, int y, int c) const { return data[(y * width + x) * COST_NUM + c]; }
+    void    set(int x, int y, int c, float v) { data[(y * width + x) * COST_NUM + c] = v; }
+    void    clear();
+
+    //--  largest and mean value of a channel
+    float   maxValue(int c) const;
+    float   meanValue(int c) const;
+
+    //--  grey PFM ("Pf") of one channel, the raw values
+    bool    writeRaw(const char *path, int c) const;
+    //--  false colour PPM of one channel : black - blue - red - yellow - white,
+    //--  white from the 99th percentile up
+    bool    writeFalseColor(const char *path, int c) const;
+    //--  <prefix>_<channel>.pfm and .ppm for every channel
+    bool    write(const char *prefix) const;
+
+    static const char *channelName(int c);
+
+  private :
+    int width;
+    int height;
+    std::vector<float> data;
+};
+
+#endif // __COSTMAP_H__
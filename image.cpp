@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstring>
+
+#include "image.h"
+
+CImage::CImage(int w, int h) {
+  width  = w;
+  height = h;
+  data   = new float[w * h * 3];
+  clear();
+}
+
+CImage::~CImage() {
+  delete [] data;
+}
+
+void
+CImage::setPixel(int x, int y, const Vector3 &rgb)
+{
+  float *px = &data[(y * width + x) * 3];
+  px[0] = rgb.x();
+  px[1] = rgb.y();
+  px[2] = rgb.z();
+}
+
+Vector3
+CImage::getPixel(int x, int y)
+{
+  return Vector3(&data[(y * width + x) * 3]);
+}
+
+void
+CImage::clear()
+{
+  memset(data, 0, sizeof(float) * width * height * 3);
+}
+
+bool
+CImage::writePPM(const char *path)
+{
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  fprintf(fp, "P6\n%d %d\n255\n", width, height);
+
+  unsigned char *line = new unsigned char[width * 3];
+  for (int y = 0; y < height; y++) {
+    for (int i = 0; i < width * 3; i++) {
+      //--  same clamping as glColor3d
+      float v = data[y * width * 3 + i];
+      v = (v < 0.0f) ? 0.0f : (v > 1.0f) ? 1.0f : v;
+      line[i] = (unsigned char)(v * 255.0f + 0.5f);
+    }
+    fwrite(line, 1, width * 3, fp);
+  }
+  delete [] line;
+
+  return fclose(fp) == 0;
+}
+
+bool
+CImage::writePFM(const char *path)
+{
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  //--  negative scale = little endian
+  fprintf(fp, "PF\n%d %d\n-1.0\n", width, height);
+
+  //--  PFM scanlines are stored bottom to top
+  for (int y = height - 1; y >= 0; y--) {
+    fwrite(&data[y * width * 3], sizeof(float), width * 3, fp);
+  }
+  return fclose(fp) == 0;
+}
+
+bool
+CImage::write(const char *path)
+{
+  const char *ext = strrchr(path, '.');
+  if (ext && strcmp(ext, ".pfm") == 0) return writePFM(path);
+  return writePPM(path);
+}
@@ -0,0 +1,38 @@
+//image.h
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include "vector3.h"
+
+using WebCore::Vector3;
+
+//--  in-memory RGB framebuffer (float per channel, row 0 = top)
+class CImage {
+  public :
+    CImage(int w, int h);
+    ~CImage();
+
+    int    getWidth()  { return width; }
+    int    getHeight() { return height; }
+    float *getData()   { return data; }
+
+    void    setPixel(int x, int y, const Vector3 &rgb);
+    Vector3 getPixel(int x, int y);
+    void    clear();
+
+    //--  8bit binary PPM (clamped to [0,1]) / little endian PFM
+    bool    writePPM(const char *path);
+    bool    writePFM(const char *path);
+    //--  choose format from file extension (.pfm or else .ppm)
+    bool    write(const char *path);
+
+  private :
+    CImage(const CImage &);
+    CImage &operator =(const CImage &);
+
+    int    width;
+    int    height;
+    float *data;
+};
+
+#endif // __IMAGE_H__
@@ -1,6 +1,13 @@
 //main.h
+//--  glGenBuffers() and friends (OpenGL 1.5)
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
-#include "object.h"
+#include "tracer.h"
+#include "sppm.h"
+#include "caustic.h"
+#include "shadow.h"
+#include "wavefront.h"
+#include "renderer.h"
 
 //using namespace std;
 #define WINW 512
@@ -9,57 +16,16 @@
 #define WPOSY 50
 
 
-// ----- Scene Description -----
-int szImg = 512;            //--  rendering screen size
-int nrTypes = 2;            //--  object tpye = 0:SPHERE, 1:PLANE
-int nrObjects = 0;          //--  num of object
-
-// ----- Photon Mapping -----
-int   nrPhotons = 2000;     //--  Number of Photons Emitted
-int   nrBounces = 3;        //--  Number of Times Each Photon Bounces
-bool  lightPhotons = true;  //--  Enable Photon Lighting?
-float exposure = 100.0;     //--  Number of Photons Integrated at Brightest Pixel
-int   numPhotons[64];       //--  Photon Count for Each Scene Object
-
-//  Allocated Memory for Per-Object Photon Info
-//  0 : location
-//  1 : direction
-//  2 : energy
-Vector3 photons[64][5000][3];
-
-
 /**functions**/
 
-Vector3 reflect(
-    CObj *ob,
-    const Vector3 &point,
-    const Vector3 &ray,
-    const Vector3 &fromPoint);
-Vector3 refract(
-    CObj *ob,
-    const Vector3 &point,
-    const Vector3 &ray,
-    const Vector3 &fromPoint,
-    float &ref);
-
-Vector3 gatherPhotons(const Vector3 &p, CObj *ob);
-void    emitPhotons();
-void    storePhoton(CObj *ob,
-    const Vector3 &location,
-    const Vector3 &direction,
-    const Vector3 &energy );
-void    shadowPhoton(const Vector3 &ray, const Vector3 &pnt);
 void    drawPhoton(const Vector3 &rgb, const Vector3 &p);
-
-
-Vector3 mulColor(const Vector3 &rgbIn, CObj *ob);
+void    drawPhotons();
+void    drawFrame(CImage &img);
 
 void render();
+void renderSppm();
 void resetRender();
 
-void initObje();
-void freeObje();
-
 void display();
 void resize (int w, int h);
 void onKeyPress(unsigned char key, int x, int y);
@@ -72,6 +38,17 @@ void onTimer(int val);
 bool empty = true;
 //--  to switch Views
 bool view3D = false;
+//--  progressive photon mapping : one pass per display()
+bool sppmView = false;
+CSppm  *sppm = NULL;
+CImage *sppmFrame = NULL;
+//--  image of render(), uploaded as a whole by display()
+CImage *frame = NULL;
+//--  photons projected by drawPhoton() (x, y, r, g, b each), drawn by
+//--  drawPhotons() from one vertex buffer
+std::vector<float> photonVerts;
+GLuint photonVbo = 0;
+bool   photonVboDirty = false;
 
 bool mouseDragging = false;
 int  mouseX, mouseY;
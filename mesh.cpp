@@ -0,0 +1,485 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mesh.h"
+#include "object.h"
+#include "packet.h"
+#include "stats.h"
+
+static size_t
+align64(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+CMesh::CMesh()
+  : map(NULL), mapSize(0), ntri(0), stride(0), digest(FNV_BASIS)
+{
+  for (int k = 0; k < 9; k++) tri[k] = NULL;
+  for (int k = 0; k < 3; k++) { bmin[k] = 0.0f; bmax[k] = 0.0f; }
+}
+
+CMesh::~CMesh()
+{
+  release();
+}
+
+void
+CMesh::release()
+{
+  bvh.clear();
+  store.clear();
+  if (map) munmap(map, mapSize);
+  map     = NULL;
+  mapSize = 0;
+  ntri    = 0;
+  stride  = 0;
+  digest  = FNV_BASIS;
+  for (int k = 0; k < 9; k++) tri[k] = NULL;
+}
+
+void
+CMesh::setArrays(const float *base, int st)
+{
+  stride = st;
+  for (int k = 0; k < 9; k++) tri[k] = base + (size_t)k * st;
+
+  //--  triangles do not change once set : hashed here, not per hash()
+  digest = fnvHash(&ntri, sizeof(ntri));
+  for (int k = 0; k < 9 && ntri > 0; k++) digest = fnvHash(tri[k], sizeof(float) * ntri, digest);
+}
+
+void
+CMesh::getBounds(float *mn, float *mx) const
+{
+  for (int k = 0; k < 3; k++) { mn[k] = bmin[k]; mx[k] = bmax[k]; }
+}
+
+unsigned long long
+CMesh::hash(unsigned long long h) const
+{
+  return fnvHash(&digest, sizeof(digest), h);
+}
+
+size_t
+CMesh::memoryUsage() const
+{
+  if (map) return mapSize;
+  return store.size() * sizeof(float) + (size_t)bvh.numNodes() * sizeof(SBvhNode)
+       + (size_t)ntri * sizeof(int);
+}
+
+//------------
+//  Building
+//------------
+
+void
+CMesh::setTriangles(int num, const float *verts)
+{
+  release();
+  ntri = num;
+  if (ntri == 0) return;
+
+  //--  triangle boxes, padded for the float rounding of the hit test
+  std::vector<float> pmin(3 * ntri), pmax(3 * ntri);
+  for (int k = 0; k < 3; k++) { bmin[k] = 1.0e30f; bmax[k] = -1.0e30f; }
+  for (int i = 0; i < ntri; i++) {
+    const float *v = &verts[9 * i];
+    for (int k = 0; k < 3; k++) {
+      float lo = std::min(v[k], std::min(v[3 + k], v[6 + k]));
+      float hi = std::max(v[k], std::max(v[3 + k], v[6 + k]));
+      float pad = 1.0e-5f * (std::max(fabsf(lo), fabsf(hi)) + 1.0f);
+      pmin[3 * i + k] = lo - pad;
+      pmax[3 * i + k] = hi + pad;
+      bmin[k] = std::min(bmin[k], lo);
+      bmax[k] = std::max(bmax[k], hi);
+    }
+  }
+  bvh.build(ntri, &pmin[0], &pmax[0], 4);
+
+  //--  v0, e1, e2 in leaf order : a leaf is a contiguous range of lanes
+  //--  8 extra lanes let the kernels read whole vectors past the end
+  const int   st    = (ntri + 7) / 8 * 8 + 8;
+  const int  *order = bvh.primOrder();
+  store.assign((size_t)9 * st, 0.0f);
+  for (int i = 0; i < ntri; i++) {
+    const float *v = &verts[9 * order[i]];
+    for (int k = 0; k < 3; k++) {
+      store[(size_t)(0 + k) * st + i] = v[k];
+      store[(size_t)(3 + k) * st + i] = v[3 + k] - v[k];
+      store[(size_t)(6 + k) * st + i] = v[6 + k] - v[k];
+    }
+  }
+  setArrays(&store[0], st);
+}
+
+//--  next vertex index of an OBJ face token ("7", "7/1", "7//3", "-1")
+static bool
+parseFaceIndex(const char *&s, int nvert, int &index)
+{
+  while (*s == ' ' || *s == '\t') s++;
+  char *end;
+  long  i = strtol(s, &end, 10);
+  if (end == s) return false;
+  s = end;
+  while (*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n') s++;
+
+  index = (i < 0) ? nvert + i : i - 1;
+  return index >= 0 && index < nvert;
+}
+
+bool
+CMesh::loadObj(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) return false;
+
+  std::vector<float> vert, tris;
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    const char *s = line;
+    while (*s == ' ' || *s == '\t') s++;
+
+    if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+      char *end;
+      s += 2;
+      for (int k = 0; k < 3; k++) {
+        vert.push_back(strtof(s, &end));
+        s = end;
+      }
+    } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+      s += 2;
+      const int nvert = vert.size() / 3;
+      int first, prev, cur;
+      if (!parseFaceIndex(s, nvert, first) || !parseFaceIndex(s, nvert, prev)) continue;
+      //--  fan : (first, prev, cur)
+      while (parseFaceIndex(s, nvert, cur)) {
+        tris.insert(tris.end(), &vert[3 * first], &vert[3 * first] + 3);
+        tris.insert(tris.end(), &vert[3 * prev],  &vert[3 * prev]  + 3);
+        tris.insert(tris.end(), &vert[3 * cur],   &vert[3 * cur]   + 3);
+        prev = cur;
+      }
+    }
+  }
+  fclose(fp);
+
+  if (tris.empty()) return false;
+  setTriangles(tris.size() / 9, &tris[0]);
+  return true;
+}
+
+bool
+CMesh::saveBinary(const char *path) const
+{
+  SMeshHeader hd;
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, MESH_MAGIC, 8);
+  hd.version    = MESH_VERSION;
+  hd.numTris    = ntri;
+  hd.numNodes   = bvh.numNodes();
+  hd.stride     = stride;
+  for (int k = 0; k < 3; k++) { hd.bmin[k] = bmin[k]; hd.bmax[k] = bmax[k]; }
+  hd.nodeOffset = align64(sizeof(hd));
+  hd.triOffset  = align64(hd.nodeOffset + (size_t)hd.numNodes * sizeof(SBvhNode));
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) return false;
+
+  static const char zero[64] = {0};
+  bool ok = fwrite(&hd, sizeof(hd), 1, fp) == 1;
+  if (hd.nodeOffset > (long long)sizeof(hd)) {
+    ok = ok && fwrite(zero, hd.nodeOffset - sizeof(hd), 1, fp) == 1;
+  }
+  if (hd.numNodes > 0) {
+    ok = ok && fwrite(bvh.nodeData(), sizeof(SBvhNode), hd.numNodes, fp) == (size_t)hd.numNodes;
+  }
+  size_t gap = hd.triOffset - hd.nodeOffset - (size_t)hd.numNodes * sizeof(SBvhNode);
+  if (gap > 0) ok = ok && fwrite(zero, gap, 1, fp) == 1;
+  for (int k = 0; k < 9 && ntri > 0; k++) {
+    ok = ok && fwrite(tri[k], sizeof(float), stride, fp) == (size_t)stride;
+  }
+  return fclose(fp) == 0 && ok;
+}
+
+bool
+CMesh::loadBinary(const char *path)
+{
+  release();
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(SMeshHeader)) {
+    close(fd);
+    return false;
+  }
+  void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+
+  //--  header, then the BVH (CBvh::attach()); vertices are used as they are
+  const SMeshHeader *hd = (const SMeshHeader *)p;
+  const size_t size = sb.st_size;
+  bool ok = memcmp(hd->magic, MESH_MAGIC, 8) == 0 && hd->version == MESH_VERSION
+    && hd->numTris >= 0 && hd->numNodes >= 0
+    && (hd->numTris == 0 || hd->stride >= hd->numTris + 8)
+    && hd->nodeOffset >= (long long)sizeof(SMeshHeader)
+    && hd->nodeOffset + (long long)hd->numNodes * (long long)sizeof(SBvhNode) <= hd->triOffset
+    && hd->triOffset + 9LL * hd->stride * (long long)sizeof(float) <= (long long)size;
+  ok = ok && bvh.attach((const SBvhNode *)((const char *)p + hd->nodeOffset), hd->numNodes, hd->numTris);
+  if (!ok) {
+    munmap(p, size);
+    return false;
+  }
+
+  map     = p;
+  mapSize = size;
+  ntri    = hd->numTris;
+  for (int k = 0; k < 3; k++) { bmin[k] = hd->bmin[k]; bmax[k] = hd->bmax[k]; }
+  setArrays((const float *)((const char *)p + hd->triOffset), hd->stride);
+  return true;
+}
+
+bool
+CMesh::load(const char *path)
+{
+  size_t n = strlen(path);
+  if (n >= 6 && !strcmp(path + n - 6, ".pmesh")) return loadBinary(path);
+  return loadObj(path);
+}
+
+//---------------------------------------------------------------------
+//  Ray-Triangle Intersection (Moller-Trumbore), in float
+//  The SIMD kernels repeat the scalar arithmetic operation by operation
+//  and keep the first lane of the smallest t : results are identical.
+//---------------------------------------------------------------------
+
+typedef struct SMeshHit {
+  const float *const *tri;
+  float o[3], d[3];
+  float tmin;           //--  accepted : t >= tmin
+  float best;           //--  accepted : t <  best
+  int   prim;
+  int   level;
+
+  double tmax() const { return best; }
+  bool   done() const { return false; }
+  void   testLeaf(int first, int count);
+} SMeshHit;
+
+//--  any-hit variant : same leaf kernels, traversal ends at the first hit
+typedef struct SMeshAnyHit : SMeshHit {
+  bool   done() const { return prim >= 0; }
+} SMeshAnyHit;
+
+static void
+triangleScalar(SMeshHit &h, int first, int count)
+{
+  const float *const *tr = h.tri;
+  for (int i = first; i < first + count; i++) {
+    float e1x = tr[3][i], e1y = tr[4][i], e1z = tr[5][i];
+    float e2x = tr[6][i], e2y = tr[7][i], e2z = tr[8][i];
+
+    float px = h.d[1] * e2z - h.d[2] * e2y;
+    float py = h.d[2] * e2x - h.d[0] * e2z;
+    float pz = h.d[0] * e2y - h.d[1] * e2x;
+    float det = e1x * px + e1y * py + e1z * pz;
+    float inv = 1.0f / det;
+
+    float sx = h.o[0] - tr[0][i];
+    float sy = h.o[1] - tr[1][i];
+    float sz = h.o[2] - tr[2][i];
+    float u  = (sx * px + sy * py + sz * pz) * inv;
+
+    float qx = sy * e1z - sz * e1y;
+    float qy = sz * e1x - sx * e1z;
+    float qz = sx * e1y - sy * e1x;
+    float v  = (h.d[0] * qx + h.d[1] * qy + h.d[2] * qz) * inv;
+    float t  = (e2x * qx + e2y * qy + e2z * qz) * inv;
+
+    //--  written as in the kernels : NaN fails every test
+    if (det != 0.0f && u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f
+        && t >= h.tmin && t < h.best) {
+      h.best = t;
+      h.prim = i;
+    }
+  }
+}
+
+//--  4 lanes per step
+static void
+triangleSSE2(SMeshHit &h, int first, int count)
+{
+  const float *const *tr = h.tri;
+  const __m128 dx = _mm_set1_ps(h.d[0]), dy = _mm_set1_ps(h.d[1]), dz = _mm_set1_ps(h.d[2]);
+  const __m128 ox = _mm_set1_ps(h.o[0]), oy = _mm_set1_ps(h.o[1]), oz = _mm_set1_ps(h.o[2]);
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  const __m128 tmin = _mm_set1_ps(h.tmin);
+
+  for (int k = first; k < first + count; k += 4) {
+    __m128 e1x = _mm_loadu_ps(&tr[3][k]), e1y = _mm_loadu_ps(&tr[4][k]), e1z = _mm_loadu_ps(&tr[5][k]);
+    __m128 e2x = _mm_loadu_ps(&tr[6][k]), e2y = _mm_loadu_ps(&tr[7][k]), e2z = _mm_loadu_ps(&tr[8][k]);
+
+    __m128 px  = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py  = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz  = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 inv = _mm_div_ps(one, det);
+
+    __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&tr[0][k]));
+    __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&tr[1][k]));
+    __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&tr[2][k]));
+    __m128 u  = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v  = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+    __m128 t  = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+    __m128 ok = _mm_cmpneq_ps(det, zero);
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(u, zero));
+    ok = _mm_and_ps(ok, _mm_cmple_ps(u, one));
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(v, zero));
+    ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(t, tmin));
+    ok = _mm_and_ps(ok, _mm_cmplt_ps(t, _mm_set1_ps(h.best)));
+
+    int mask = _mm_movemask_ps(ok);
+    if (first + count - k < 4) mask &= (1 << (first + count - k)) - 1;
+    if (!mask) continue;
+
+    float tv[4];
+    _mm_storeu_ps(tv, t);
+    for (int i = 0; i < 4; i++) {
+      if ((mask >> i & 1) && tv[i] < h.best) { h.best = tv[i]; h.prim = k + i; }
+    }
+  }
+}
+
+//--  8 lanes per step
+__attribute__((target("avx2"))) static void
+triangleAVX2(SMeshHit &h, int first, int count)
+{
+  const float *const *tr = h.tri;
+  const __m256 dx = _mm256_set1_ps(h.d[0]), dy = _mm256_set1_ps(h.d[1]), dz = _mm256_set1_ps(h.d[2]);
+  const __m256 ox = _mm256_set1_ps(h.o[0]), oy = _mm256_set1_ps(h.o[1]), oz = _mm256_set1_ps(h.o[2]);
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+  const __m256 tmin = _mm256_set1_ps(h.tmin);
+
+  for (int k = first; k < first + count; k += 8) {
+    __m256 e1x = _mm256_loadu_ps(&tr[3][k]), e1y = _mm256_loadu_ps(&tr[4][k]), e1z = _mm256_loadu_ps(&tr[5][k]);
+    __m256 e2x = _mm256_loadu_ps(&tr[6][k]), e2y = _mm256_loadu_ps(&tr[7][k]), e2z = _mm256_loadu_ps(&tr[8][k]);
+
+    __m256 px  = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py  = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz  = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 inv = _mm256_div_ps(one, det);
+
+    __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&tr[0][k]));
+    __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&tr[1][k]));
+    __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&tr[2][k]));
+    __m256 u  = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inv);
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    __m256 v  = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv);
+    __m256 t  = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv);
+
+    __m256 ok = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+    ok = _mm256_and_ps(ok, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    ok = _mm256_and_ps(ok, _mm256_cmp_ps(u, one,  _CMP_LE_OQ));
+    ok = _mm256_and_ps(ok, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    ok = _mm256_and_ps(ok, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+    ok = _mm256_and_ps(ok, _mm256_cmp_ps(t, tmin, _CMP_GE_OQ));
+    ok = _mm256_and_ps(ok, _mm256_cmp_ps(t, _mm256_set1_ps(h.best), _CMP_LT_OQ));
+
+    int mask = _mm256_movemask_ps(ok);
+    if (first + count - k < 8) mask &= (1 << (first + count - k)) - 1;
+    if (!mask) continue;
+
+    float tv[8];
+    _mm256_storeu_ps(tv, t);
+    for (int i = 0; i < 8; i++) {
+      if ((mask >> i & 1) && tv[i] < h.best) { h.best = tv[i]; h.prim = k + i; }
+    }
+  }
+  //--  avoid the AVX/SSE transition penalty in the (SSE2) caller
+  _mm256_zeroupper();
+}
+
+void
+SMeshHit::testLeaf(int first, int count)
+{
+  statAdd(STAT_TEST_TRIANGLE, count);
+  if      (level == SIMD_AVX2)   triangleAVX2  (*this, first, count);
+  else if (level == SIMD_SSE2)   triangleSSE2  (*this, first, count);
+  else                           triangleScalar(*this, first, count);
+}
+
+double
+CMesh::intersect(const double *org, const double *dir,
+                 double tmin, double tmax, int &prim) const
+{
+  prim = -1;
+  if (ntri == 0) return NOT_INTERSECTED;
+
+  SMeshHit h;
+  h.tri   = tri;
+  h.level = activeSimdLevel();
+  for (int k = 0; k < 3; k++) { h.o[k] = org[k]; h.d[k] = dir[k]; }
+  //--  smallest float t with (double)t > tmin
+  h.tmin = tmin;
+  if (h.tmin <= tmin) h.tmin = nextafterf(h.tmin, HUGE_VALF);
+  h.best = std::min(tmax, (double)NOT_INTERSECTED);
+  h.prim = -1;
+
+  SBvhRay br;
+  setBvhRay(br, org, dir);
+  bvh.intersectLeaves(br, h);
+
+  prim = h.prim;
+  return (h.prim < 0) ? NOT_INTERSECTED : h.best;
+}
+
+bool
+CMesh::occluded(const double *org, const double *dir, double tmin, double tmax) const
+{
+  if (ntri == 0) return false;
+
+  SMeshAnyHit h;
+  h.tri   = tri;
+  h.level = activeSimdLevel();
+  for (int k = 0; k < 3; k++) { h.o[k] = org[k]; h.d[k] = dir[k]; }
+  h.tmin = tmin;
+  if (h.tmin <= tmin) h.tmin = nextafterf(h.tmin, HUGE_VALF);
+  h.best = std::min(tmax, (double)NOT_INTERSECTED);
+  h.prim = -1;
+
+  SBvhRay br;
+  setBvhRay(br, org, dir);
+  bvh.intersectLeaves(br, h);
+  return h.prim >= 0;
+}
+
+void
+CMesh::getNormal(int prim, double *n) const
+{
+  double e1[3] = { tri[3][prim], tri[4][prim], tri[5][prim] };
+  double e2[3] = { tri[6][prim], tri[7][prim], tri[8][prim] };
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
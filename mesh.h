@@ -0,0 +1,80 @@
+//mesh.h
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#include <vector>
+#include <cstddef>
+#include "bvh.h"
+
+//--  binary mesh file (.pmesh), native little endian, read by mmap
+//--    header | BVH nodes | 9 triangle arrays (v0, e1 = v1 - v0, e2 = v2 - v0)
+//--  triangles are stored in BVH leaf order, sections are 64 byte aligned
+#define MESH_MAGIC   "PMMESH\r\n"
+#define MESH_VERSION 1
+
+typedef struct SMeshHeader {
+  char  magic[8];
+  int   version;
+  int   numTris;
+  int   numNodes;
+  int   stride;         //--  floats per triangle array (>= numTris + 8)
+  float bmin[3];
+  float bmax[3];
+  long long nodeOffset; //--  bytes from the file start
+  long long triOffset;
+} SMeshHeader;
+
+//--  triangle mesh with its own BVH, intersected in object space
+class CMesh {
+  public :
+    CMesh();
+    ~CMesh();
+
+    //--  ntri triangles, 9 floats (3 vertices) each
+    void    setTriangles(int ntri, const float *verts);
+    //--  Wavefront OBJ : v and f records only, polygons are fanned
+    bool    loadObj(const char *path);
+    //--  .pmesh : mapped, nothing is parsed or rebuilt
+    bool    loadBinary(const char *path);
+    bool    saveBinary(const char *path) const;
+    //--  .pmesh by extension, OBJ otherwise
+    bool    load(const char *path);
+
+    int     numTriangles() const { return ntri; }
+    int     numNodes()     const { return bvh.numNodes(); }
+    bool    isMapped()     const { return map != NULL; }
+    void    getBounds(float *mn, float *mx) const;
+    size_t  memoryUsage()  const;
+    //--  FNV-1a of the triangles, chained through h
+    unsigned long long hash(unsigned long long h) const;
+
+    //--  closest triangle hit with tmin < t < tmax, NOT_INTERSECTED if none
+    //--  prim : triangle in storage order
+    double  intersect(const double *org, const double *dir,
+                      double tmin, double tmax, int &prim) const;
+    //--  any triangle hit with tmin < t < tmax : the traversal stops at the
+    //--  first leaf with a hit
+    bool    occluded(const double *org, const double *dir,
+                     double tmin, double tmax) const;
+    //--  geometric normal (e1 x e2, not normalized)
+    void    getNormal(int prim, double *n) const;
+
+  private :
+    CMesh(const CMesh &);
+    CMesh &operator =(const CMesh &);
+
+    void    release();
+    void    setArrays(const float *base, int stride);
+
+    CBvh    bvh;
+    const float *tri[9];       //--  v0x v0y v0z e1x e1y e1z e2x e2y e2z
+    std::vector<float> store;  //--  owned arrays (setTriangles)
+    void   *map;               //--  mapped file (loadBinary)
+    size_t  mapSize;
+    int     ntri;
+    int     stride;
+    float   bmin[3], bmax[3];
+    unsigned long long digest; //--  FNV-1a of the triangles
+};
+
+#endif // __MESH_H__
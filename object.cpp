@@ -1,19 +1,67 @@
+#include <algorithm>
 #include "object.h"
+#include "mesh.h"
+#include "stats.h"
 
-CObj::CObj(int tp, int idx, float *cod) {
-
-  index = idx;
-  optic = OPT_NONE;
-  refractive = 1.0;
-  type = tp;
+float
+CObj::getCoord(int i)
+{
+  const int sl = getSlot();
+  switch (getType()) {
+  case TYPE_SPHERE :
+    switch (i) {
+    case 0 : return scene.sphereX[sl];
+    case 1 : return scene.sphereY[sl];
+    case 2 : return scene.sphereZ[sl];
+    case 3 : return scene.sphereR[sl];
+    }
+    break;
+  case TYPE_PLANE :
+    switch (i) {
+    case 0 : return scene.planeAxis[sl];
+    case 1 : return scene.planeDist[sl];
+    }
+    break;
+  case TYPE_TRIANGLE :
+    switch (i) {
+    case 0 : return scene.meshX[sl];
+    case 1 : return scene.meshY[sl];
+    case 2 : return scene.meshZ[sl];
+    case 3 : return scene.meshScale[sl];
+    }
+    break;
+  }
+  return 0.0;
+}
 
-  int ncods = 0;
-  switch(tp) {
-  case TYPE_SPHERE : ncods=4; break;
-  case TYPE_PLANE  : ncods=2; break;
+void
+CObj::setCoord(int i, float v)
+{
+  const int sl = getSlot();
+  switch (getType()) {
+  case TYPE_SPHERE :
+    switch (i) {
+    case 0 : scene.sphereX[sl] = v; break;
+    case 1 : scene.sphereY[sl] = v; break;
+    case 2 : scene.sphereZ[sl] = v; break;
+    case 3 : scene.sphereR[sl] = v; break;
+    }
+    break;
+  case TYPE_PLANE :
+    switch (i) {
+    case 0 : scene.planeAxis[sl] = (int)v; break;
+    case 1 : scene.planeDist[sl] = v;      break;
+    }
+    break;
+  case TYPE_TRIANGLE :
+    switch (i) {
+    case 0 : scene.meshX[sl]     = v; break;
+    case 1 : scene.meshY[sl]     = v; break;
+    case 2 : scene.meshZ[sl]     = v; break;
+    case 3 : scene.meshScale[sl] = v; break;
+    }
+    break;
   }
-  for(int i=0; i<ncods; i++) coords[i] = cod[i];
-  for(int i=0; i<3; i++) color[i] = 1.0;
 }
 
 
@@ -21,7 +69,8 @@ Vector3
 CObj::calcSphereNormal(const Vector3 &P, const Vector3 &O)
 {
   //球の中心を引き算-->法線ベクトル
-  Vector3 center(coords[0], coords[1], coords[2]);
+  const int sl = getSlot();
+  Vector3 center(scene.sphereX[sl], scene.sphereY[sl], scene.sphereZ[sl]);
   Vector3 ans = P - center;
   ans.normalize();
   return ans;
@@ -30,45 +79,98 @@ CObj::calcSphereNormal(const Vector3 &P, const Vector3 &O)
 Vector3
 CObj::calcPlaneNormal(const Vector3 &P, const Vector3 &O)
 {
-  int axis = (int) this->coords[0];
-  float N[3] = {0.0,0.0,0.0};
-  N[axis] = O[axis] - this->coords[1];      //Vector From Surface to Light
-  Vector3 ans(N);
+  const int sl = getSlot();
+  int axis = scene.planeAxis[sl];
+  Vector3 ans;
+  ans[axis] = O[axis] - scene.planeDist[sl];  //Vector From Surface to Light
+  ans.normalize();
+  return ans;
+}
+
+Vector3
+CObj::calcTriangleNormal(int prim, const Vector3 &P, const Vector3 &O)
+{
+  //--  face normal, turned to O like the planes (uniform scale : no change)
+  double n[3];
+  getMesh()->getNormal(prim, n);
+  Vector3 ans(n);
+  if (dot(ans, O - P) < 0.0) ans = ans * -1.0;
   ans.normalize();
   return ans;
 }
 
 
-double
+real
 CObj::calcSphereIntersection(const Vector3 &r, const Vector3 &o) //Ray-Sphere Intersection: r=Ray Direction, o=Ray Origin
 {
-  //  s = Sphere Center Translated into Coordinate Frame of Ray Origin
-  Vector3 center(coords[0], coords[1], coords[2]);
-  Vector3 s = center - o;
+  const int sl = getSlot();
+  return intersectSphere(scene.sphereX[sl], scene.sphereY[sl], scene.sphereZ[sl], scene.sphereR[sl], r, o);
+}
 
-  //radius=Sphere Radius
-  float radius = coords[3];
+real
+CObj::calcPlaneIntersection(const Vector3 &r, const Vector3 &o)
+{
+  const int sl = getSlot();
+  return intersectPlane(scene.planeAxis[sl], scene.planeDist[sl], r, o);
+}
 
-  //Intersection of Sphere and Line     =       Quadratic Function of Distance
-  float A = dot(r,r);
-  float B = -2.0 * dot(s,r);
-  float C = dot(s,s) - radius * radius;
-  float D = B * B - 4 * A * C;
+real
+CObj::calcTriangleIntersection(const Vector3 &r, const Vector3 &o, int &prim)
+{
+  //--  ray into the object space of the mesh : t is unchanged
+  statAdd(STAT_TEST_MESH);
+  const int sl = getSlot();
+  double scale = scene.meshScale[sl];
+  double off[3] = { scene.meshX[sl], scene.meshY[sl], scene.meshZ[sl] };
+  double org[3], dir[3];
+  for (int i = 0; i < 3; i++) {
+    org[i] = (o[i] - off[i]) / scale;
+    dir[i] = r[i] / scale;
+  }
+  return scene.meshData[sl]->intersect(org, dir, 1.0e-5, NOT_INTERSECTED, prim);
+}
 
-  //  二次方程式に解がある場合のみ，距離が算出できる
-  if (D > 0.0) {
-    float sign = (C < -0.00001) ? 1 : -1;
-    return (-B + sign*sqrt(D))/(2*A);
+bool
+CObj::calcTriangleOcclusion(const Vector3 &r, const Vector3 &o, real tmax)
+{
+  statAdd(STAT_TEST_MESH);
+  const int sl = getSlot();
+  double scale = scene.meshScale[sl];
+  double off[3] = { scene.meshX[sl], scene.meshY[sl], scene.meshZ[sl] };
+  double org[3], dir[3];
+  for (int i = 0; i < 3; i++) {
+    org[i] = (o[i] - off[i]) / scale;
+    dir[i] = r[i] / scale;
   }
-  return NOT_INTERSECTED;
+  return scene.meshData[sl]->occluded(org, dir, 1.0e-5, tmax);
 }
 
-double
-CObj::calcPlaneIntersection(const Vector3 &r, const Vector3 &o)
+bool
+CObj::getBounds(float *bmin, float *bmax)
 {
-  int axis = (int) coords[0];            //Determine Orientation of Axis-Aligned Plane
-  if (r[axis] != 0.0){                        //Parallel Ray -> No Intersection
-    return  (coords[1] - o[axis]) / r[axis]; //Solve Linear Equation (rx = p-o)
+  const int sl = getSlot();
+  const int tp = getType();
+  if (tp == TYPE_TRIANGLE) {
+    const float off[3] = { scene.meshX[sl], scene.meshY[sl], scene.meshZ[sl] };
+    const float scale  = scene.meshScale[sl];
+    scene.meshData[sl]->getBounds(bmin, bmax);
+    for (int i = 0; i < 3; i++) {
+      float pad = 1.0e-4f * (fabsf(bmin[i]) + fabsf(bmax[i]) + 1.0f) * scale;
+      bmin[i] = bmin[i] * scale + off[i] - pad;
+      bmax[i] = bmax[i] * scale + off[i] + pad;
+    }
+    return true;
+  }
+  if (tp != TYPE_SPHERE) return false;
+
+  //--  calcSphereIntersection() works in float : pad for its rounding
+  const float center[3] = { scene.sphereX[sl], scene.sphereY[sl], scene.sphereZ[sl] };
+  float radius = scene.sphereR[sl];
+  float pad    = 1.0e-3f * (radius + std::max(std::max(fabsf(center[0]), fabsf(center[1])), fabsf(center[2])))
+               + 1.0e-4f;
+  for (int i = 0; i < 3; i++) {
+    bmin[i] = center[i] - radius - pad;
+    bmax[i] = center[i] + radius + pad;
   }
-  return NOT_INTERSECTED;
+  return true;
 }
@@ -1,54 +1,67 @@
 //CObj.h
+#ifndef __OBJECT_H__
+#define __OBJECT_H__
+
 #include <cstdlib>
 #include "vector3.h"
+#include "scene.h"
 
 using WebCore::Vector3;
 
-#define TYPE_SPHERE   0
-#define TYPE_PLANE    1
-#define TYPE_TRIANGLE 2
-
-#define OPT_NONE 0
-#define OPT_REFLECT 1
-#define OPT_REFRACT 2
-
-#define NOT_INTERSECTED (1.0e6)
-
+//--  thin view on one object of the scene arrays, by object index
 class CObj {
   /**֐**/
   public :
-    CObj(int type, int idx, float *cod);
-    int    getType()   { return type; }
-    int    getOptics() { return optic; }
+    explicit CObj(int idx) : index(idx) {}
+    int    getType()   { return scene.type[index]; }
+    int    getOptics() { return scene.material[index].optic; }
     int    getIndex()  { return index; }
-    float  getRefractive()  { return refractive; }
-    void   setOptics(int op)   { optic = op; }
-    void   setRefractive(float rf)   { this->refractive = rf; }
+    int    getSlot()   { return scene.slot[index]; }
+    float  getRefractive()  { return scene.material[index].refractive; }
+    void   setOptics(int op)   { scene.material[index].optic = op; }
+    void   setRefractive(float rf)   { scene.material[index].refractive = rf; }
     void   setColor(const float *cl) {
-      for(int i=0; i<3; i++) color[i] = cl[i];
+      for(int i=0; i<3; i++) scene.material[index].color[i] = cl[i];
     }
-    float coords[9];
-    float color[3];
+    const float *getColor()    { return scene.material[index].color; }
+    //--  TYPE_TRIANGLE : triangles in object space (not owned)
+    void   setMesh(CMesh *ms)  { scene.meshData[getSlot()] = ms; }
+    CMesh *getMesh()           { return scene.meshData[getSlot()]; }
+
+    //--  coords as SScene::add() takes them : sphere {center, radius},
+    //--  plane {axis, distance}, triangle mesh {offset, scale}
+    float  getCoord(int i);
+    void   setCoord(int i, float v);
 
     Vector3 calcSphereNormal(const Vector3 &P, const Vector3 &O);
     Vector3 calcPlaneNormal(const Vector3 &P, const Vector3 &O);
+    Vector3 calcTriangleNormal(int prim, const Vector3 &P, const Vector3 &O);
+
+    real    calcSphereIntersection(const Vector3 &ray, const Vector3 &org);
+    real    calcPlaneIntersection(const Vector3 &ray, const Vector3 &org);
+    //--  prim : hit triangle of the mesh
+    real    calcTriangleIntersection(const Vector3 &ray, const Vector3 &org, int &prim);
+    //--  any triangle hit with 1e-5 < t < tmax
+    bool    calcTriangleOcclusion(const Vector3 &ray, const Vector3 &org, real tmax);
 
-    double  calcSphereIntersection(const Vector3 &ray, const Vector3 &org);
-    double  calcPlaneIntersection(const Vector3 &ray, const Vector3 &org);
+    //--  box enclosing every hit calc*Intersection() can return
+    //--  false for unbounded objects (planes)
+    bool    getBounds(float *bmin, float *bmax);
 
     /**ϐ**/
   private :
-    int type;
-    int optic;
     int index;
-    float refractive;
 };
 
 typedef struct SIntersectionStat {
   CObj    *obj;
-  double  dist;
+  real    dist;
+  int     prim;     //--  triangle of a mesh (0 for other types)
   SIntersectionStat() {
     dist = NOT_INTERSECTED;
     obj = NULL;
+    prim = 0;
   }
 } SIntersectionStat;
+
+#endif // __OBJECT_H__
@@ -0,0 +1,249 @@
+//------------------------------------------------
+//  Ray Tracing & Photon Mapping : offline renderer
+//  renders a whole frame without GL and writes it to a file
+//------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+#include "tracer.h"
+#include "image.h"
+#include "renderer.h"
+#include "threads.h"
+#include "packet.h"
+#include "stats.h"
+#include "sppm.h"
+#include "caustic.h"
+#include "shadow.h"
+#include "wavefront.h"
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+      "usage: %s [options]\n"
+      "  -o <file>   output image, .ppm or .pfm (default: out.ppm)\n"
+      "  -s <size>   image size in pixels (default: %d)\n"
+      "  -p <num>    number of photons emitted (default: %d)\n"
+      "  -b <num>    number of photon bounces (default: %d)\n"
+      "  -rr         Russian roulette : photons go on with probability max(albedo)\n"
+      "  -sampler <s> photon random numbers : legacy, random or halton (default: legacy)\n"
+      "  -e <val>    photon exposure (default: %.1f)\n"
+      "  -c <num>    max num of stored photons, 0 : unlimited (default: %d)\n"
+      "  -r <seed>   seed of the photon random streams (default: %u)\n"
+      "  -t <num>    worker threads, 0 : all cores (default: %d)\n"
+      "  -d          direct lighting instead of photon mapping\n"
+      "  -sp <num>   -d : shadow map of num photons, shadow rays only in penumbrae (default: off)\n"
+      "  -sr <val>   shadow map cell size (default: %.2f)\n"
+      "  -l          linear photon gather instead of the kd-tree\n"
+      "  -n <num>    add num random spheres to the scene (default: 0)\n"
+      "  -a          linear ray casting instead of the BVH\n"
+      "  -m <file>   add a triangle mesh, .obj or .pmesh\n"
+      "  -w <file>   save the mesh of -m as .pmesh\n"
+      "  -simd <isa> primary ray packets : auto, avx2, sse2, scalar or off\n"
+      "  -wave       secondary rays and photon bounces a generation at a time, sorted\n"
+      "  -stats      print the hot path counters\n"
+      "  -json <file> write the hot path counters as JSON\n"
+      "  -cost <prefix> per pixel cost maps, <prefix>_<cycles|rays|depth|photons>.pfm/.ppm\n"
+      "  -sppm <num> progressive photon mapping, num passes of -p photons\n"
+      "  -alpha <val> share of new photons kept per pass (default: %.2f)\n"
+      "  -cache <dir> map the photons from <dir> if this scene was emitted before\n"
+      "  -irr <step> precomputed irradiance at every step-th photon (default: off)\n"
+      "  -caustic <num> caustic map of num photons aimed at mirrors and glass (default: off)\n"
+      "  -cr <val>   caustic gather radius (default: %.2f)\n"
+      "  -aa <num>   adaptive supersampling from num samples per pixel (default: off)\n"
+      "  -aamax <num> max samples per pixel of -aa (default: %d)\n"
+      "  -aat <val>  contrast or noise asking for more samples (default: %.3f)\n",
+      prog, szImg, nrPhotons, nrBounces, exposure, photonCapacity, photonSeed, nrThreads, shadowRadius,
+      sppmAlpha, causticRadius, aaMaxSamples, aaThreshold);
+}
+
+int
+main(int argc, char *argv[]) {
+  const char *output = "out.ppm";
+  int  extra_spheres  = 0;
+  const char *mesh_in  = NULL;
+  const char *mesh_out = NULL;
+  bool  print_stats    = false;
+  const char *stats_json = NULL;
+  const char *cost_out   = NULL;
+  int   sppm_passes      = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    bool  has_val   = (i + 1 < argc);
+    if      (!strcmp(opt, "-o") && has_val) { output    = argv[++i]; }
+    else if (!strcmp(opt, "-s") && has_val) { szImg     = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-p") && has_val) { nrPhotons = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-b") && has_val) { nrBounces = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-e") && has_val) { exposure  = atof(argv[++i]); }
+    else if (!strcmp(opt, "-c") && has_val) { photonCapacity = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-r") && has_val) { photonSeed = strtoul(argv[++i], NULL, 10); }
+    else if (!strcmp(opt, "-t") && has_val) { nrThreads = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-rr"))           { russianRoulette = true; }
+    else if (!strcmp(opt, "-sampler") && has_val) {
+      const char *smp = argv[++i];
+      if      (!strcmp(smp, "random")) photonSampler = SAMPLER_RANDOM;
+      else if (!strcmp(smp, "halton")) photonSampler = SAMPLER_HALTON;
+      else                             photonSampler = SAMPLER_LEGACY;
+    }
+    else if (!strcmp(opt, "-d"))            { lightPhotons = false; }
+    else if (!strcmp(opt, "-sp") && has_val) { nrShadowPhotons = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-sr") && has_val) { shadowRadius    = atof(argv[++i]); }
+    else if (!strcmp(opt, "-l"))            { usePhotonMap = false; }
+    else if (!strcmp(opt, "-n") && has_val) { extra_spheres = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-a"))            { useBvh = false; }
+    else if (!strcmp(opt, "-m") && has_val) { mesh_in  = argv[++i]; }
+    else if (!strcmp(opt, "-w") && has_val) { mesh_out = argv[++i]; }
+    else if (!strcmp(opt, "-wave"))         { useWavefront = true; }
+    else if (!strcmp(opt, "-stats"))        { print_stats = true; }
+    else if (!strcmp(opt, "-json") && has_val) { stats_json = argv[++i]; }
+    else if (!strcmp(opt, "-cost") && has_val) { cost_out   = argv[++i]; }
+    else if (!strcmp(opt, "-sppm") && has_val) { sppm_passes = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-alpha") && has_val) { sppmAlpha  = atof(argv[++i]); }
+    else if (!strcmp(opt, "-cache") && has_val) { photonCache = argv[++i]; }
+    else if (!strcmp(opt, "-caustic") && has_val) { nrCaustics = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-cr") && has_val)    { causticRadius = atof(argv[++i]); }
+    else if (!strcmp(opt, "-aa") && has_val)    { aaSamples     = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-aamax") && has_val) { aaMaxSamples  = atoi(argv[++i]); }
+    else if (!strcmp(opt, "-aat") && has_val)   { aaThreshold   = atof(argv[++i]); }
+    else if (!strcmp(opt, "-irr") && has_val) {
+      precomputeStep = atoi(argv[++i]);
+      usePrecomputed = precomputeStep > 0;
+    }
+    else if (!strcmp(opt, "-simd") && has_val) {
+      const char *isa = argv[++i];
+      usePackets = strcmp(isa, "off") != 0;
+      if      (!strcmp(isa, "avx2"))   simdLevel = SIMD_AVX2;
+      else if (!strcmp(isa, "sse2"))   simdLevel = SIMD_SSE2;
+      else if (!strcmp(isa, "scalar")) simdLevel = SIMD_SCALAR;
+      else                             simdLevel = SIMD_AUTO;
+    }
+    else { usage(argv[0]); return 1; }
+  }
+  if (szImg <= 0) { usage(argv[0]); return 1; }
+
+  //--  scene
+  double t0 = now();
+  initObje();
+  if (extra_spheres > 0) addRandomSpheres(extra_spheres, photonSeed);
+  if (mesh_in) {
+    //--  on the floor, left of the glass sphere
+    static const float center[3] = { -0.7, -1.0, 3.4 };
+    CObj *ob = loadMesh(mesh_in, center, 1.0);
+    if (!ob) {
+      fprintf(stderr, "cannot load mesh %s\n", mesh_in);
+      return 1;
+    }
+    if (mesh_out && !ob->getMesh()->saveBinary(mesh_out)) {
+      fprintf(stderr, "cannot write mesh %s\n", mesh_out);
+      return 1;
+    }
+  }
+  double t1 = now();
+
+  CImage img(szImg, szImg);
+  CCostMap cost(cost_out ? szImg : 0, cost_out ? szImg : 0);
+  CSppm sppm(sppm_passes > 0 ? szImg : 0, sppm_passes > 0 ? szImg : 0);
+  double emit_time, render_time;
+  bool   cache_hit = false;
+  if (sppm_passes > 0) {
+    //--  visible points once (render), then the passes (emit)
+    sppm.traceVisiblePoints();
+    double t2 = now();
+    for (int p = 0; p < sppm_passes; p++) sppm.pass();
+    double t3 = now();
+    sppm.resolve(img);
+    emit_time   = t3 - t2;
+    render_time = now() - t1 - emit_time;
+  } else {
+    //--  photons
+    if (lightPhotons) cache_hit = preparePhotons();
+    else              emitShadowPhotons();
+    double t2 = now();
+
+    //--  whole frame, one sample per pixel (same mapping as render())
+    //--  or adaptive supersampling with -aa
+    if (cost_out) costMap = &cost;
+    renderFrame(img);
+    costMap = NULL;
+    emit_time   = t2 - t1;
+    render_time = now() - t2;
+  }
+  double t3 = now();
+
+  bool ok = img.write(output);
+  if (cost_out) ok = cost.write(cost_out) && ok;
+  double t4 = now();
+
+  //--  every worker has finished : the thread blocks are complete
+  SStatBlock stats;
+  statsCollect(stats);
+
+  const int  num_objects = nrObjects;
+  int num_tris = 0;
+  for (size_t m = 0; m < meshes.size(); m++) num_tris += meshes[m]->numTriangles();
+  const int  bvh_nodes   = (useBvh && !sceneBvh.empty()) ? sceneBvh.numNodes() : 0;
+  freeObje();
+
+  printf("scene  : %10.3f ms\n", (t1 - t0) * 1.0e3);
+  printf("emit   : %10.3f ms\n", emit_time   * 1.0e3);
+  printf("render : %10.3f ms\n", render_time * 1.0e3);
+  printf("write  : %10.3f ms  (%s)\n", (t4 - t3) * 1.0e3, output);
+  printf("total  : %10.3f ms\n", (t4 - t0) * 1.0e3);
+  printf("simd   : %s%s\n", usePackets ? simdName(activeSimdLevel()) : "off",
+      useWavefront ? ", wavefront" : "");
+  printf("objects: %d, bvh %d nodes, %d triangles\n", num_objects, bvh_nodes, num_tris);
+  if (sppm_passes > 0) {
+    printf("sppm   : %d passes, %lld photons, %.2f MB\n",
+        sppm.numPasses(), sppm.numPhotons(), sppm.memoryUsage() / (1024.0 * 1024.0));
+  }
+  if (lightPhotons) {
+    printf("photons: %d stored, %d dropped, %.2f MB%s\n",
+        photonStore.size(), photonStore.getDropped(),
+        photonStore.memoryUsage() / (1024.0 * 1024.0),
+        cache_hit ? " (mapped from the cache)" : "");
+    if (nrCaustics > 0) {
+      printf("caustic: %d stored of %d, projection map %.1f%% of the directions\n",
+          causticStore.size(), nrCaustics, projectionMap.coverage() * 100.0);
+    }
+  }
+  if (!lightPhotons && nrShadowPhotons > 0 && sppm_passes == 0) {
+    printf("shadow : %d photons in %d cells, %.1f%% of the shadow rays skipped\n",
+        shadowStore.size(), shadowGrid.numCells(), 100.0 * stats.count[STAT_SHADOW_SKIPPED] /
+        std::max(1ULL, stats.count[STAT_SHADOW_SKIPPED] + stats.count[STAT_RAY_SHADOW]));
+  }
+  if (aaSamples > 0 && sppm_passes == 0 && !cost_out) {
+    printf("aa     : %.2f samples per pixel (%d to %d)\n",
+        (double)stats.count[STAT_RAY_PRIMARY] / ((double)szImg * szImg), aaSamples, aaMaxSamples);
+  }
+  if (cost_out) {
+    int at_limit = 0;
+    for (int y = 0; y < szImg; y++) {
+      for (int x = 0; x < szImg; x++) at_limit += cost.get(x, y, COST_DEPTH) >= reflection_limit;
+    }
+    printf("cost   : %-8s %12s %12s\n", "", "mean", "max");
+    for (int c = 0; c < COST_NUM; c++) {
+      printf("         %-8s %12.1f %12.1f\n", CCostMap::channelName(c), cost.meanValue(c), cost.maxValue(c));
+    }
+    printf("         %d pixels at reflection_limit (%d)\n", at_limit, reflection_limit);
+  }
+  if (print_stats) statsPrint(stdout, stats);
+  if (stats_json) {
+    FILE *fp = fopen(stats_json, "w");
+    if (fp) { statsWriteJson(fp, stats); fclose(fp); }
+    else    { fprintf(stderr, "cannot write %s\n", stats_json); ok = false; }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "tracer.h"
+#include "packet.h"
+
+int simdLevel = SIMD_AUTO;
+
+static int
+detectSimdLevel()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+}
+
+int
+activeSimdLevel()
+{
+  static const int supported = detectSimdLevel();
+  if (simdLevel == SIMD_AUTO) return supported;
+  return std::min(simdLevel, supported);
+}
+
+const char *
+simdName(int level)
+{
+  switch (level) {
+    case SIMD_SCALAR : return "scalar";
+    case SIMD_SSE2   : return "sse2";
+    case SIMD_AVX2   : return "avx2";
+  }
+  return "auto";
+}
+
+//--  the kernels repeat the double arithmetic of intersectSphere() :
+//--  a float tracer (REAL_FLOAT) takes the scalar path to stay identical
+static inline int
+packetLevel()
+{
+#ifdef REAL_FLOAT
+  return SIMD_SCALAR;
+#else
+  return activeSimdLevel();
+#endif
+}
+
+void
+setPacketRay(SRayPacket &rp, int lane, const Vector3 &ray, const Vector3 &origin)
+{
+  rp.ox[lane] = origin.x(); rp.oy[lane] = origin.y(); rp.oz[lane] = origin.z();
+  rp.dx[lane] = ray.x();    rp.dy[lane] = ray.y();    rp.dz[lane] = ray.z();
+}
+
+//--------------------------------------------------------------------
+//  The kernels repeat the arithmetic of CObj::calcSphereIntersection()
+//  operation by operation : dot products in double, the quadratic in
+//  float, the sign test on C in double.  Plane hits stay in double.
+//--------------------------------------------------------------------
+
+static void
+intersectScalar(CObj *ob, const SRayPacket &rp, double *dist, int *prim)
+{
+  for (int i = 0; i < rp.num; i++) {
+    Vector3 r(rp.dx[i], rp.dy[i], rp.dz[i]);
+    Vector3 o(rp.ox[i], rp.oy[i], rp.oz[i]);
+    dist[i] = rayObject(ob, r, o, prim[i]);
+  }
+}
+
+static const double *
+laneAxis(const double *x, const double *y, const double *z, int axis)
+{
+  return axis == 0 ? x : (axis == 1 ? y : z);
+}
+
+//--  4 lanes from k
+static void
+sphereSSE2(int sl, const SRayPacket &rp, int k, double *dist)
+{
+  const __m128d cx   = _mm_set1_pd(scene.sphereX[sl]);
+  const __m128d cy   = _mm_set1_pd(scene.sphereY[sl]);
+  const __m128d cz   = _mm_set1_pd(scene.sphereZ[sl]);
+  const float   radius = scene.sphereR[sl];
+  const __m128d rad2 = _mm_set1_pd(radius * radius);
+
+  __m128 a[2], b[2], c[2], sg[2];
+  for (int h = 0; h < 2; h++) {
+    const int l = k + 2 * h;
+    __m128d rx = _mm_loadu_pd(&rp.dx[l]);
+    __m128d ry = _mm_loadu_pd(&rp.dy[l]);
+    __m128d rz = _mm_loadu_pd(&rp.dz[l]);
+    __m128d sx = _mm_sub_pd(cx, _mm_loadu_pd(&rp.ox[l]));
+    __m128d sy = _mm_sub_pd(cy, _mm_loadu_pd(&rp.oy[l]));
+    __m128d sz = _mm_sub_pd(cz, _mm_loadu_pd(&rp.oz[l]));
+
+    __m128d rr = _mm_add_pd(_mm_add_pd(_mm_mul_pd(rx, rx), _mm_mul_pd(ry, ry)), _mm_mul_pd(rz, rz));
+    __m128d sr = _mm_add_pd(_mm_add_pd(_mm_mul_pd(sx, rx), _mm_mul_pd(sy, ry)), _mm_mul_pd(sz, rz));
+    __m128d ss = _mm_add_pd(_mm_add_pd(_mm_mul_pd(sx, sx), _mm_mul_pd(sy, sy)), _mm_mul_pd(sz, sz));
+
+    a[h] = _mm_cvtpd_ps(rr);
+    b[h] = _mm_cvtpd_ps(_mm_mul_pd(_mm_set1_pd(-2.0), sr));
+    c[h] = _mm_cvtpd_ps(_mm_sub_pd(ss, rad2));
+
+    //--  sign = (C < -0.00001) ? 1 : -1, compared in double
+    __m128d inside = _mm_cmplt_pd(_mm_cvtps_pd(c[h]), _mm_set1_pd(-0.00001));
+    __m128d sign   = _mm_or_pd(_mm_and_pd(inside, _mm_set1_pd(1.0)),
+                               _mm_andnot_pd(inside, _mm_set1_pd(-1.0)));
+    sg[h] = _mm_cvtpd_ps(sign);
+  }
+  __m128 A = _mm_movelh_ps(a[0], a[1]);
+  __m128 B = _mm_movelh_ps(b[0], b[1]);
+  __m128 C = _mm_movelh_ps(c[0], c[1]);
+  __m128 S = _mm_movelh_ps(sg[0], sg[1]);
+
+  __m128 D = _mm_sub_ps(_mm_mul_ps(B, B), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), A), C));
+  __m128 negB = _mm_xor_ps(B, _mm_set1_ps(-0.0f));
+  __m128 t = _mm_div_ps(_mm_add_ps(negB, _mm_mul_ps(S, _mm_sqrt_ps(D))),
+                        _mm_mul_ps(_mm_set1_ps(2.0f), A));
+  int hit = _mm_movemask_ps(_mm_cmpgt_ps(D, _mm_setzero_ps()));
+
+  double td[4];
+  _mm_storeu_pd(&td[0], _mm_cvtps_pd(t));
+  _mm_storeu_pd(&td[2], _mm_cvtps_pd(_mm_movehl_ps(t, t)));
+  for (int i = 0; i < 4; i++) dist[k + i] = (hit >> i & 1) ? td[i] : NOT_INTERSECTED;
+}
+
+static void
+planeSSE2(int sl, const SRayPacket &rp, int k, double *dist)
+{
+  const int     axis = scene.planeAxis[sl];
+  const double *ra   = laneAxis(rp.dx, rp.dy, rp.dz, axis);
+  const double *oa   = laneAxis(rp.ox, rp.oy, rp.oz, axis);
+  const __m128d c    = _mm_set1_pd(scene.planeDist[sl]);
+
+  for (int h = 0; h < 2; h++) {
+    const int l = k + 2 * h;
+    __m128d r = _mm_loadu_pd(&ra[l]);
+    __m128d t = _mm_div_pd(_mm_sub_pd(c, _mm_loadu_pd(&oa[l])), r);
+    int hit   = _mm_movemask_pd(_mm_cmpneq_pd(r, _mm_setzero_pd()));
+
+    double td[2];
+    _mm_storeu_pd(td, t);
+    for (int i = 0; i < 2; i++) dist[l + i] = (hit >> i & 1) ? td[i] : NOT_INTERSECTED;
+  }
+}
+
+//--  8 lanes
+__attribute__((target("avx2"))) static void
+sphereAVX2(int sl, const SRayPacket &rp, double *dist)
+{
+  const __m256d cx   = _mm256_set1_pd(scene.sphereX[sl]);
+  const __m256d cy   = _mm256_set1_pd(scene.sphereY[sl]);
+  const __m256d cz   = _mm256_set1_pd(scene.sphereZ[sl]);
+  const float   radius = scene.sphereR[sl];
+  const __m256d rad2 = _mm256_set1_pd(radius * radius);
+
+  __m128 a[2], b[2], c[2], sg[2];
+  for (int h = 0; h < 2; h++) {
+    const int l = 4 * h;
+    __m256d rx = _mm256_loadu_pd(&rp.dx[l]);
+    __m256d ry = _mm256_loadu_pd(&rp.dy[l]);
+    __m256d rz = _mm256_loadu_pd(&rp.dz[l]);
+    __m256d sx = _mm256_sub_pd(cx, _mm256_loadu_pd(&rp.ox[l]));
+    __m256d sy = _mm256_sub_pd(cy, _mm256_loadu_pd(&rp.oy[l]));
+    __m256d sz = _mm256_sub_pd(cz, _mm256_loadu_pd(&rp.oz[l]));
+
+    __m256d rr = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz));
+    __m256d sr = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(sx, rx), _mm256_mul_pd(sy, ry)), _mm256_mul_pd(sz, rz));
+    __m256d ss = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(sx, sx), _mm256_mul_pd(sy, sy)), _mm256_mul_pd(sz, sz));
+
+    a[h] = _mm256_cvtpd_ps(rr);
+    b[h] = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_set1_pd(-2.0), sr));
+    c[h] = _mm256_cvtpd_ps(_mm256_sub_pd(ss, rad2));
+
+    __m256d inside = _mm256_cmp_pd(_mm256_cvtps_pd(c[h]), _mm256_set1_pd(-0.00001), _CMP_LT_OQ);
+    sg[h] = _mm256_cvtpd_ps(_mm256_blendv_pd(_mm256_set1_pd(-1.0), _mm256_set1_pd(1.0), inside));
+  }
+  __m256 A = _mm256_insertf128_ps(_mm256_castps128_ps256(a[0]),  a[1],  1);
+  __m256 B = _mm256_insertf128_ps(_mm256_castps128_ps256(b[0]),  b[1],  1);
+  __m256 C = _mm256_insertf128_ps(_mm256_castps128_ps256(c[0]),  c[1],  1);
+  __m256 S = _mm256_insertf128_ps(_mm256_castps128_ps256(sg[0]), sg[1], 1);
+
+  __m256 D = _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), A), C));
+  __m256 negB = _mm256_xor_ps(B, _mm256_set1_ps(-0.0f));
+  __m256 t = _mm256_div_ps(_mm256_add_ps(negB, _mm256_mul_ps(S, _mm256_sqrt_ps(D))),
+                           _mm256_mul_ps(_mm256_set1_ps(2.0f), A));
+  int hit = _mm256_movemask_ps(_mm256_cmp_ps(D, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+  double td[8];
+  _mm256_storeu_pd(&td[0], _mm256_cvtps_pd(_mm256_castps256_ps128(t)));
+  _mm256_storeu_pd(&td[4], _mm256_cvtps_pd(_mm256_extractf128_ps(t, 1)));
+  for (int i = 0; i < 8; i++) dist[i] = (hit >> i & 1) ? td[i] : NOT_INTERSECTED;
+
+  //--  avoid the AVX/SSE transition penalty in the (SSE2) caller
+  _mm256_zeroupper();
+}
+
+__attribute__((target("avx2"))) static void
+planeAVX2(int sl, const SRayPacket &rp, double *dist)
+{
+  const int     axis = scene.planeAxis[sl];
+  const double *ra   = laneAxis(rp.dx, rp.dy, rp.dz, axis);
+  const double *oa   = laneAxis(rp.ox, rp.oy, rp.oz, axis);
+  const __m256d c    = _mm256_set1_pd(scene.planeDist[sl]);
+
+  for (int h = 0; h < 2; h++) {
+    const int l = 4 * h;
+    __m256d r = _mm256_loadu_pd(&ra[l]);
+    __m256d t = _mm256_div_pd(_mm256_sub_pd(c, _mm256_loadu_pd(&oa[l])), r);
+    int hit   = _mm256_movemask_pd(_mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_NEQ_UQ));
+
+    double td[4];
+    _mm256_storeu_pd(td, t);
+    for (int i = 0; i < 4; i++) dist[l + i] = (hit >> i & 1) ? td[i] : NOT_INTERSECTED;
+  }
+  _mm256_zeroupper();
+}
+
+void
+intersectPacket(CObj *ob, const SRayPacket &rp, double *dist, int *prim)
+{
+  const int tp    = ob->getType();
+  const int level = packetLevel();
+
+  //--  meshes : one ray at a time, the triangle tests are vectorized instead
+  if (level == SIMD_SCALAR || (tp != TYPE_SPHERE && tp != TYPE_PLANE)) {
+    intersectScalar(ob, rp, dist, prim);
+    return;
+  }
+  for (int i = 0; i < PACKET_SIZE; i++) prim[i] = 0;
+  statAdd(tp == TYPE_SPHERE ? STAT_TEST_SPHERE : STAT_TEST_PLANE, rp.num);
+  const int sl = ob->getSlot();
+  if (level == SIMD_AVX2) {
+    if (tp == TYPE_SPHERE) sphereAVX2(sl, rp, dist);
+    else                   planeAVX2 (sl, rp, dist);
+  } else {
+    for (int k = 0; k < rp.num; k += 4) {
+      if (tp == TYPE_SPHERE) sphereSSE2(sl, rp, k, dist);
+      else                   planeSSE2 (sl, rp, k, dist);
+    }
+  }
+}
+
+//--  keep the closer hit of ob per lane, same rule as raytrace()
+static inline void
+updatePacketHits(CObj *ob, const SRayPacket &rp, SIntersectionStat *istat)
+{
+  double dist[PACKET_SIZE];
+  int    prim[PACKET_SIZE];
+  intersectPacket(ob, rp, dist, prim);
+  for (int i = 0; i < rp.num; i++) {
+    if (closerHit(istat[i], dist[i], ob)) {
+      istat[i].dist = dist[i];
+      istat[i].obj  = ob;
+      istat[i].prim = prim[i];
+    }
+  }
+}
+
+//--  spheres or planes straight from the scene arrays, kernel chosen once
+static void
+updatePacketHitsOfType(int tp, const SRayPacket &rp, SIntersectionStat *istat)
+{
+  const int  level = packetLevel();
+  const int  num   = (tp == TYPE_SPHERE) ? scene.sphereObj.size() : scene.planeObj.size();
+  if (num == 0) return;
+  const int *ids   = (tp == TYPE_SPHERE) ? &scene.sphereObj[0]    : &scene.planeObj[0];
+  statAdd(tp == TYPE_SPHERE ? STAT_TEST_SPHERE : STAT_TEST_PLANE, (StatCount)num * rp.num);
+
+  double dist[PACKET_SIZE];
+  for (int sl = 0; sl < num; sl++) {
+    if (level == SIMD_AVX2) {
+      if (tp == TYPE_SPHERE) sphereAVX2(sl, rp, dist);
+      else                   planeAVX2 (sl, rp, dist);
+    } else if (level == SIMD_SSE2) {
+      for (int k = 0; k < rp.num; k += 4) {
+        if (tp == TYPE_SPHERE) sphereSSE2(sl, rp, k, dist);
+        else                   planeSSE2 (sl, rp, k, dist);
+      }
+    } else {
+      for (int i = 0; i < rp.num; i++) {
+        Vector3 r(rp.dx[i], rp.dy[i], rp.dz[i]);
+        Vector3 o(rp.ox[i], rp.oy[i], rp.oz[i]);
+        dist[i] = (tp == TYPE_SPHERE)
+          ? intersectSphere(scene.sphereX[sl], scene.sphereY[sl], scene.sphereZ[sl], scene.sphereR[sl], r, o)
+          : intersectPlane(scene.planeAxis[sl], scene.planeDist[sl], r, o);
+      }
+    }
+
+    CObj *ob = &objects[ids[sl]];
+    for (int i = 0; i < rp.num; i++) {
+      if (closerHit(istat[i], dist[i], ob)) {
+        istat[i].dist = dist[i];
+        istat[i].obj  = ob;
+        istat[i].prim = 0;
+      }
+    }
+  }
+}
+
+//--  depth first BVH traversal : a node is entered when any lane hits its box
+static void
+traversePacket(const SRayPacket &rp, SIntersectionStat *istat)
+{
+  SBvhRay br[PACKET_SIZE];
+  for (int i = 0; i < rp.num; i++) {
+    double org[3] = { rp.ox[i], rp.oy[i], rp.oz[i] };
+    double dir[3] = { rp.dx[i], rp.dy[i], rp.dz[i] };
+    setBvhRay(br[i], org, dir);
+  }
+
+  int stack[64];
+  int sp = 0;
+  stack[sp++] = 0;
+  while (sp > 0) {
+    const SBvhNode &nd = sceneBvh.node(stack[--sp]);
+
+    bool   hit = false;
+    double tnear;
+    for (int i = 0; i < rp.num && !hit; i++) {
+      hit = hitBvhNode(nd, br[i], istat[i].dist, tnear);
+    }
+    if (!hit) continue;
+
+    if (nd.count > 0) {
+      for (int j = 0; j < nd.count; j++) {
+        updatePacketHits(&objects[boundedIds[sceneBvh.prim(nd.offset + j)]], rp, istat);
+      }
+    } else {
+      stack[sp++] = nd.offset;
+      stack[sp++] = &nd - &sceneBvh.node(0) + 1;
+    }
+  }
+}
+
+void
+raytracePacket(const SRayPacket &in, SIntersectionStat *istat)
+{
+  //--  unused lanes repeat lane 0 so that the kernels never see garbage
+  SRayPacket rp = in;
+  for (int i = rp.num; i < PACKET_SIZE; i++) {
+    rp.ox[i] = rp.ox[0]; rp.oy[i] = rp.oy[0]; rp.oz[i] = rp.oz[0];
+    rp.dx[i] = rp.dx[0]; rp.dy[i] = rp.dy[0]; rp.dz[i] = rp.dz[0];
+  }
+
+  for (int i = 0; i < rp.num; i++) istat[i] = SIntersectionStat();
+
+  if (useBvh && !sceneBvh.empty()) {
+    for (size_t p = 0; p < planeIds.size(); p++) updatePacketHits(&objects[planeIds[p]], rp, istat);
+    traversePacket(rp, istat);
+    return;
+  }
+
+  //--  same test as raytrace() : the first closest object wins, one loop per type
+  updatePacketHitsOfType(TYPE_SPHERE, rp, istat);
+  updatePacketHitsOfType(TYPE_PLANE,  rp, istat);
+  for (size_t i = 0; i < scene.meshObj.size(); i++) updatePacketHits(&objects[scene.meshObj[i]], rp, istat);
+}
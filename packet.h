@@ -0,0 +1,39 @@
+//packet.h
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include "object.h"
+
+#define PACKET_SIZE 8
+
+//--  instruction set of the packet kernels
+#define SIMD_AUTO   (-1)    //--  best one supported by the cpu
+#define SIMD_SCALAR 0
+#define SIMD_SSE2   1       //--  4 lanes
+#define SIMD_AVX2   2       //--  8 lanes
+
+//--  up to PACKET_SIZE rays, one lane per ray (struct of arrays)
+typedef struct SRayPacket {
+  double ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];   //--  origins
+  double dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];   //--  directions
+  int    num;                                                 //--  active lanes
+} SRayPacket;
+
+extern int simdLevel;       //--  SIMD_AUTO, SIMD_SCALAR, SIMD_SSE2 or SIMD_AVX2
+
+//--  simdLevel resolved against the cpu
+int  activeSimdLevel();
+const char *simdName(int level);
+
+void setPacketRay(SRayPacket &rp, int lane, const Vector3 &ray, const Vector3 &origin);
+
+//--  distance per lane, bit-identical to CObj::calcSphereIntersection()
+//--  and CObj::calcPlaneIntersection() (NOT_INTERSECTED if missed)
+//--  prim : hit triangle per lane for meshes, 0 otherwise
+//--  the SIMD kernels read all PACKET_SIZE lanes : unused lanes must hold valid rays
+void intersectPacket(CObj *ob, const SRayPacket &rp, double *dist, int *prim);
+
+//--  closest hit per lane, same result as raytrace() on each lane
+void raytracePacket(const SRayPacket &rp, SIntersectionStat *istat);
+
+#endif // __PACKET_H__
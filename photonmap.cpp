@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "photonmap.h"
+#include "threads.h"
+
+//--------------
+//  Photon Store
+//--------------
+
+template <typename T> static T *
+alignedAlloc(int n)
+{
+  void *p = NULL;
+  if (n > 0 && posix_memalign(&p, PHOTON_ALIGN, sizeof(T) * n) != 0) return NULL;
+  return (T *)p;
+}
+
+//--  round up so that every array starts on its own cache line
+static int
+alignedCount(int n)
+{
+  return (n + PHOTON_ALIGN - 1) / PHOTON_ALIGN * PHOTON_ALIGN;
+}
+
+static size_t
+align64(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+CPhotonStore::CPhotonStore() {
+  pos = dir = power = NULL;
+  obj   = NULL;
+  plane = NULL;
+  map   = NULL;
+  mapSize = 0;
+  count = allocated = capacity = dropped = 0;
+}
+
+CPhotonStore::~CPhotonStore() {
+  release();
+}
+
+//--  arrays freed or unmapped, the photons are gone
+void
+CPhotonStore::release()
+{
+  if (map) {
+    munmap(map, mapSize);
+  } else {
+    free(pos);
+    free(dir);
+    free(power);
+    free(obj);
+    free(plane);
+  }
+  pos = dir = power = NULL;
+  obj   = NULL;
+  plane = NULL;
+  map   = NULL;
+  mapSize   = 0;
+  allocated = 0;
+  count     = 0;
+}
+
+void
+CPhotonStore::clear()
+{
+  //--  a mapped file is not written to
+  if (map) release();
+  count   = 0;
+  dropped = 0;
+  offset.clear();
+}
+
+void
+CPhotonStore::reserve(int n)
+{
+  if (capacity > 0) n = std::min(n, capacity);
+  if (n > allocated) grow(n);
+}
+
+void
+CPhotonStore::grow(int n)
+{
+  n = alignedCount(n);
+
+  float         *npos   = alignedAlloc<float>(3 * n);
+  float         *ndir   = alignedAlloc<float>(3 * n);
+  float         *npower = alignedAlloc<float>(3 * n);
+  int           *nobj   = alignedAlloc<int>(n);
+  unsigned char *nplane = alignedAlloc<unsigned char>(n);
+
+  if (count > 0) {
+    memcpy(npos,   pos,   sizeof(float) * 3 * count);
+    memcpy(ndir,   dir,   sizeof(float) * 3 * count);
+    memcpy(npower, power, sizeof(float) * 3 * count);
+    memcpy(nobj,   obj,   sizeof(int)   * count);
+    memcpy(nplane, plane, count);
+  }
+  const int keep = count;
+  release();
+  pos   = npos;
+  dir   = ndir;
+  power = npower;
+  obj   = nobj;
+  plane = nplane;
+  count = keep;
+  allocated = n;
+}
+
+bool
+CPhotonStore::store(int ob, const Vector3 &p, const Vector3 &d, const Vector3 &e)
+{
+  if (capacity > 0 && count >= capacity) {
+    dropped++;
+    return false;
+  }
+  if (count >= allocated) {
+    int n = std::max(allocated * 2, 1024);
+    if (capacity > 0) n = std::min(n, capacity);
+    grow(n);
+  }
+
+  float *pp = &pos  [3 * count];
+  float *dp = &dir  [3 * count];
+  float *ep = &power[3 * count];
+  pp[0] = p.x(); pp[1] = p.y(); pp[2] = p.z();
+  dp[0] = d.x(); dp[1] = d.y(); dp[2] = d.z();
+  ep[0] = e.x(); ep[1] = e.y(); ep[2] = e.z();
+  obj  [count] = ob;
+  plane[count] = 0;
+  count++;
+  return true;
+}
+
+void
+CPhotonStore::append(const CPhotonStore &src, int first, int last)
+{
+  int n = last - first;
+  if (capacity > 0 && count + n > capacity) {
+    dropped += count + n - capacity;
+    n = capacity - count;
+  }
+  if (n <= 0) return;
+  if (count + n > allocated) {
+    int m = std::max(allocated * 2, count + n);
+    if (capacity > 0) m = std::min(m, capacity);
+    grow(m);
+  }
+
+  memcpy(&pos  [3 * count], &src.pos  [3 * first], sizeof(float) * 3 * n);
+  memcpy(&dir  [3 * count], &src.dir  [3 * first], sizeof(float) * 3 * n);
+  memcpy(&power[3 * count], &src.power[3 * first], sizeof(float) * 3 * n);
+  memcpy(&obj  [count],     &src.obj  [first],     sizeof(int) * n);
+  memset(&plane[count], 0, n);
+  count += n;
+}
+
+void
+CPhotonStore::sortByObject(int nobj)
+{
+  //--  counting sort, stable : keeps the emission order within an object
+  offset.assign(nobj + 1, 0);
+  for (int i = 0; i < count; i++) offset[obj[i] + 1]++;
+  for (int k = 0; k < nobj; k++)  offset[k + 1] += offset[k];
+
+  std::vector<int> dst(offset.begin(), offset.end() - 1);
+  std::vector<int> perm(count);
+  for (int i = 0; i < count; i++) perm[dst[obj[i]]++] = i;
+
+  float *tmp = alignedAlloc<float>(3 * std::max(count, 1));
+  float *arrays[3] = { pos, dir, power };
+  for (int a = 0; a < 3; a++) {
+    for (int i = 0; i < count; i++) {
+      memcpy(&tmp[3 * i], &arrays[a][3 * perm[i]], sizeof(float) * 3);
+    }
+    memcpy(arrays[a], tmp, sizeof(float) * 3 * count);
+  }
+  free(tmp);
+
+  for (int k = 0; k < nobj; k++) {
+    for (int i = offset[k]; i < offset[k + 1]; i++) obj[i] = k;
+  }
+}
+
+void
+CPhotonStore::copyRange(int first, const CPhotonStore &src, int srcFirst, int n)
+{
+  memcpy(&pos  [3 * first], &src.pos  [3 * srcFirst], sizeof(float) * 3 * n);
+  memcpy(&dir  [3 * first], &src.dir  [3 * srcFirst], sizeof(float) * 3 * n);
+  memcpy(&power[3 * first], &src.power[3 * srcFirst], sizeof(float) * 3 * n);
+  memcpy(&obj  [first],     &src.obj  [srcFirst],     sizeof(int) * n);
+  memcpy(&plane[first],     &src.plane[srcFirst],     n);
+}
+
+void
+CPhotonStore::swap(CPhotonStore &other)
+{
+  std::swap(pos,       other.pos);
+  std::swap(dir,       other.dir);
+  std::swap(power,     other.power);
+  std::swap(obj,       other.obj);
+  std::swap(plane,     other.plane);
+  std::swap(map,       other.map);
+  std::swap(mapSize,   other.mapSize);
+  std::swap(count,     other.count);
+  std::swap(allocated, other.allocated);
+  std::swap(capacity,  other.capacity);
+  std::swap(dropped,   other.dropped);
+  offset.swap(other.offset);
+}
+
+bool
+CPhotonStore::saveBinary(const char *path, unsigned long long key) const
+{
+  const int nobj = (int)offset.size() - 1;
+  if (nobj < 0) return false;
+
+  SPhotonHeader hd;
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, PHOTON_MAGIC, 8);
+  hd.version     = PHOTON_VERSION;
+  hd.count       = count;
+  hd.stride      = alignedCount(count);
+  hd.numObjects  = nobj;
+  hd.dropped     = dropped;
+  hd.key         = key;
+  hd.rangeOffset = align64(sizeof(hd));
+  hd.arrayOffset = align64(hd.rangeOffset + sizeof(int) * (nobj + 1));
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) return false;
+
+  //--  arrays padded to stride photons
+  static const char zero[PHOTON_ALIGN * 3 * sizeof(float)] = {0};
+  const int pad = hd.stride - count;
+  bool ok = fwrite(&hd, sizeof(hd), 1, fp) == 1;
+  if (hd.rangeOffset > (long long)sizeof(hd)) {
+    ok = ok && fwrite(zero, hd.rangeOffset - sizeof(hd), 1, fp) == 1;
+  }
+  ok = ok && fwrite(&offset[0], sizeof(int), nobj + 1, fp) == (size_t)(nobj + 1);
+  size_t gap = hd.arrayOffset - hd.rangeOffset - sizeof(int) * (nobj + 1);
+  if (gap > 0) ok = ok && fwrite(zero, gap, 1, fp) == 1;
+  const float *arrays[3] = { pos, dir, power };
+  for (int a = 0; a < 3; a++) {
+    ok = ok && fwrite(arrays[a], sizeof(float) * 3, count, fp) == (size_t)count;
+    if (pad > 0) ok = ok && fwrite(zero, sizeof(float) * 3, pad, fp) == (size_t)pad;
+  }
+  ok = ok && fwrite(obj, sizeof(int), count, fp) == (size_t)count;
+  if (pad > 0) ok = ok && fwrite(zero, sizeof(int), pad, fp) == (size_t)pad;
+  ok = ok && fwrite(plane, 1, count, fp) == (size_t)count;
+  if (pad > 0) ok = ok && fwrite(zero, 1, pad, fp) == (size_t)pad;
+  return fclose(fp) == 0 && ok;
+}
+
+bool
+CPhotonStore::loadBinary(const char *path, unsigned long long key)
+{
+  release();
+  dropped = 0;
+  offset.clear();
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(SPhotonHeader)) {
+    close(fd);
+    return false;
+  }
+  //--  private and writable : sortByObject() or a kd-tree build on the
+  //--  mapped photons copies only the pages they touch
+  void *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+
+  //--  header, ranges, then the fields that index other arrays (object
+  //--  of each photon, kd-tree axis); positions and powers are used as they are
+  const SPhotonHeader *hd = (const SPhotonHeader *)p;
+  const size_t size = sb.st_size;
+  const long long stride = hd->stride;
+  bool ok = memcmp(hd->magic, PHOTON_MAGIC, 8) == 0 && hd->version == PHOTON_VERSION
+    && hd->key == key && hd->count >= 0 && hd->numObjects >= 0
+    && stride >= hd->count && stride % PHOTON_ALIGN == 0
+    && hd->rangeOffset >= (long long)sizeof(SPhotonHeader)
+    && hd->rangeOffset + (long long)sizeof(int) * (hd->numObjects + 1) <= hd->arrayOffset
+    && hd->arrayOffset % 64 == 0
+    && hd->arrayOffset + stride * (long long)(9 * sizeof(float) + sizeof(int) + 1) <= (long long)size;
+  if (ok) {
+    const int *range = (const int *)((const char *)p + hd->rangeOffset);
+    ok = range[0] == 0 && range[hd->numObjects] == hd->count;
+    for (int k = 0; k < hd->numObjects && ok; k++) ok = range[k] <= range[k + 1];
+  }
+  const char *base = (const char *)p + hd->arrayOffset;
+  const int *objs = (const int *)(base + sizeof(float) * 9 * stride);
+  const unsigned char *planes = (const unsigned char *)(objs + stride);
+  if (ok) {
+    //--  sorted by object : photon i of range k belongs to object k
+    const int *range = (const int *)((const char *)p + hd->rangeOffset);
+    for (int k = 0; k < hd->numObjects && ok; k++) {
+      for (int i = range[k]; i < range[k + 1] && ok; i++) ok = objs[i] == k && planes[i] <= 2;
+    }
+    if (ok) offset.assign(range, range + hd->numObjects + 1);
+  }
+  if (!ok) {
+    munmap(p, size);
+    offset.clear();
+    return false;
+  }
+
+  pos   = (float *)base;
+  dir   = pos + 3 * stride;
+  power = dir + 3 * stride;
+  obj   = (int *)objs;
+  plane = (unsigned char *)planes;
+  map       = p;
+  mapSize   = size;
+  count     = hd->count;
+  allocated = hd->stride;
+  dropped   = hd->dropped;
+  return true;
+}
+
+size_t
+CPhotonStore::memoryUsage() const
+{
+  return (size_t)allocated * (3 * 3 * sizeof(float) + sizeof(int) + sizeof(unsigned char))
+       + offset.capacity() * sizeof(int);
+}
+
+//--------------------
+//  kd-tree Photon Map
+//--------------------
+
+//--  order photons by one coordinate
+class CComparePhoton {
+  public :
+    CComparePhoton(int ax) : axis(ax) {}
+    bool operator ()(const SPhotonKey &a, const SPhotonKey &b) const {
+      return a.pos[axis] < b.pos[axis];
+    }
+  private :
+    int axis;
+};
+
+typedef struct SBalanceJob {
+  CPhotonMap               *map;
+  std::vector<SPhotonKey>  *porg;
+  std::vector<int>         *pbal;
+  std::vector<SBalanceTask> tasks;
+} SBalanceJob;
+
+void
+CPhotonMap::balanceTask(int task, int, void *arg)
+{
+  SBalanceJob  *job = (SBalanceJob *)arg;
+  SBalanceTask &t   = job->tasks[task];
+  job->map->balanceSegment(*job->porg, *job->pbal, t.index, t.start, t.end,
+                           t.bmin, t.bmax, -1, NULL);
+}
+
+void
+CPhotonMap::build(CPhotonStore *store, int first, int last, int nthreads)
+{
+  st    = store;
+  begin = first;
+  num   = last - first;
+  if (num <= 0) return;
+
+  //--  photon i of the range is porg[i] (1-based)
+  //--  positions are copied along so that partitioning stays in cache
+  std::vector<SPhotonKey> porg(num + 1);
+  std::vector<int>        pbal(num + 1);
+  float bmin[3] = { 1.0e30f,  1.0e30f,  1.0e30f};
+  float bmax[3] = {-1.0e30f, -1.0e30f, -1.0e30f};
+  for (int i = 1; i <= num; i++) {
+    const float *p = &st->pos[3 * (first + i - 1)];
+    porg[i].index = first + i - 1;
+    for (int k = 0; k < 3; k++) {
+      porg[i].pos[k] = p[k];
+      bmin[k] = std::min(bmin[k], p[k]);
+      bmax[k] = std::max(bmax[k], p[k]);
+    }
+  }
+
+  //--  porg[] is partitioned in place, pbal[] receives the heap order
+  if (nthreads > 1 && num > 65536) {
+    //--  top levels here, the disjoint subtrees below them in parallel
+    int depth = 0;
+    while ((1 << depth) < 4 * nthreads) depth++;
+
+    SBalanceJob job;
+    job.map  = this;
+    job.porg = &porg;
+    job.pbal = &pbal;
+    balanceSegment(porg, pbal, 1, 1, num, bmin, bmax, depth, &job.tasks);
+    runTasks(job.tasks.size(), nthreads, balanceTask, &job);
+  } else {
+    balanceSegment(porg, pbal, 1, 1, num, bmin, bmax, -1, NULL);
+  }
+
+  //--  permute every array of the range into heap order
+  std::vector<float> tmp(3 * num);
+  float *arrays[3] = { st->pos, st->dir, st->power };
+  for (int a = 0; a < 3; a++) {
+    for (int i = 1; i <= num; i++) {
+      memcpy(&tmp[3 * (i - 1)], &arrays[a][3 * pbal[i]], sizeof(float) * 3);
+    }
+    memcpy(&arrays[a][3 * first], &tmp[0], sizeof(float) * 3 * num);
+  }
+  std::vector<unsigned char> axes(num);
+  for (int i = 1; i <= num; i++) axes[i - 1] = st->plane[pbal[i]];
+  memcpy(&st->plane[first], &axes[0], num);
+}
+
+void
+CPhotonMap::balanceSegment(std::vector<SPhotonKey> &porg, std::vector<int> &pbal,
+                           int index, int start, int end,
+                           const float *bmin, const float *bmax,
+                           int depth, std::vector<SBalanceTask> *defer)
+{
+  if (depth == 0 && defer) {
+    SBalanceTask t;
+    t.index = index;
+    t.start = start;
+    t.end   = end;
+    for (int k = 0; k < 3; k++) { t.bmin[k] = bmin[k]; t.bmax[k] = bmax[k]; }
+    defer->push_back(t);
+    return;
+  }
+
+  //--  left-balanced median : the left subtree is always complete
+  int cnt    = end - start + 1;
+  int median = 1;
+  while (4 * median <= cnt) median += median;
+  if (3 * median <= cnt) {
+    median += median;
+    median += start - 1;
+  } else {
+    median  = end - median + 1;
+  }
+
+  //--  split along the largest extent of the bounding box
+  int axis = 2;
+  if      (bmax[0] - bmin[0] > bmax[1] - bmin[1] &&
+           bmax[0] - bmin[0] > bmax[2] - bmin[2]) axis = 0;
+  else if (bmax[1] - bmin[1] > bmax[2] - bmin[2]) axis = 1;
+
+  std::nth_element(porg.begin() + start, porg.begin() + median, porg.begin() + end + 1,
+                   CComparePhoton(axis));
+
+  pbal[index] = porg[median].index;
+  st->plane[pbal[index]] = axis;
+  float split = porg[median].pos[axis];
+
+  //--  children go to the heap positions 2i and 2i+1
+  if (median > start) {
+    float mx[3] = { bmax[0], bmax[1], bmax[2] };
+    mx[axis] = split;
+    balanceSegment(porg, pbal, 2 * index, start, median - 1, bmin, mx, depth - 1, defer);
+  }
+  if (median < end) {
+    float mn[3] = { bmin[0], bmin[1], bmin[2] };
+    mn[axis] = split;
+    balanceSegment(porg, pbal, 2 * index + 1, median + 1, end, mn, bmax, depth - 1, defer);
+  }
+}
+
+void
+CPhotonMap::nearest(const Vector3 &p, double maxRadius, SNearestPhotons &np) const
+{
+  np.found    = 0;
+  np.sqRadius = maxRadius * maxRadius;
+  if (num > 0) locateNearest(p, 1, np);
+}
+
+void
+CPhotonMap::locateNearest(const Vector3 &p, int node, SNearestPhotons &np) const
+{
+  const int    idx  = begin + node - 1;
+  const float *pp   = &st->pos[3 * idx];
+  const int    axis = st->plane[idx];
+
+  //--  visit the near side first so that the radius shrinks early
+  if (2 * node <= num) {
+    double delta = p[axis] - pp[axis];
+    int near_node = 2 * node + (delta < 0.0 ? 0 : 1);
+    if (near_node <= num) locateNearest(p, near_node, np);
+    if (delta * delta < np.sqRadius && (near_node ^ 1) <= num) {
+      locateNearest(p, near_node ^ 1, np);
+    }
+  }
+
+  double dx = p.x() - pp[0];
+  double dy = p.y() - pp[1];
+  double dz = p.z() - pp[2];
+  double d2 = dx * dx + dy * dy + dz * dz;
+  if (d2 >= np.sqRadius) return;
+
+  if (np.found < np.max) {
+    //--  fill the list, then turn it into a max-heap once it is full
+    np.found++;
+    np.sqDist[np.found] = d2;
+    np.index [np.found] = idx;
+    if (np.found == np.max) {
+      for (int k = np.found / 2; k >= 1; k--) siftDown(np, k);
+      np.sqRadius = np.sqDist[1];
+    }
+  } else {
+    //--  replace the farthest photon
+    np.sqDist[1] = d2;
+    np.index [1] = idx;
+    siftDown(np, 1);
+    np.sqRadius = np.sqDist[1];
+  }
+}
+
+void
+CPhotonMap::siftDown(SNearestPhotons &np, int k)
+{
+  double d2  = np.sqDist[k];
+  int    idx = np.index [k];
+  while (2 * k <= np.found) {
+    int c = 2 * k;
+    if (c < np.found && np.sqDist[c + 1] > np.sqDist[c]) c++;
+    if (d2 >= np.sqDist[c]) break;
+    np.sqDist[k] = np.sqDist[c];
+    np.index [k] = np.index [c];
+    k = c;
+  }
+  np.sqDist[k] = d2;
+  np.index [k] = idx;
+}
@@ -0,0 +1,248 @@
+//photonmap.h
+#ifndef __PHOTONMAP_H__
+#define __PHOTONMAP_H__
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "vector3.h"
+#include "stats.h"
+
+using WebCore::Vector3;
+
+#define PHOTON_ALIGN 64
+
+//--  binary photon map file (photon cache), native little endian, read by mmap
+//--    header | object ranges (numObjects + 1 ints) | pos | dir | power | obj | plane
+//--  photons are sorted by object and balanced (as after buildPhotonMaps()),
+//--  arrays are stride photons long and 64 byte aligned
+//--  bump PHOTON_VERSION whenever emitPhoton() stores different photons
+#define PHOTON_MAGIC   "PMPHOT\r\n"
+#define PHOTON_VERSION 3
+
+typedef struct SPhotonHeader {
+  char  magic[8];
+  int   version;
+  int   count;
+  int   stride;           //--  photons per array (>= count, multiple of PHOTON_ALIGN)
+  int   numObjects;
+  int   dropped;
+  int   reserved;
+  unsigned long long key; //--  hash of everything the photons depend on
+  long long rangeOffset;  //--  bytes from the file start
+  long long arrayOffset;
+} SPhotonHeader;
+
+//--  growable photon storage, one array per attribute (struct of arrays)
+//--  pos/dir/power : 3 floats per photon, 64 byte aligned
+//--  after sortByObject() the photons of each object are contiguous
+class CPhotonStore {
+  public :
+    CPhotonStore();
+    ~CPhotonStore();
+
+    void    clear();
+    void    reserve(int n);
+    //--  max num of stored photons (0 : unlimited)
+    void    setCapacity(int n)  { capacity = n; }
+    int     getCapacity()       { return capacity; }
+
+    //--  false if the store is full (the photon is counted as dropped)
+    bool    store(int obj, const Vector3 &pos, const Vector3 &dir, const Vector3 &power);
+    //--  copy photons [first, last) of src, same capacity rule as store()
+    void    append(const CPhotonStore &src, int first, int last);
+    //--  overwrite n photons from first on (with their kd-tree axes) by
+    //--  those of src from srcFirst on
+    void    copyRange(int first, const CPhotonStore &src, int srcFirst, int n);
+    void    sortByObject(int nobj);
+    void    swap(CPhotonStore &other);
+
+    //--  photon cache file : the store must be sorted by object
+    bool    saveBinary(const char *path, unsigned long long key) const;
+    //--  mapped, nothing is copied; false if missing, invalid or of another key
+    //--  (the store is left empty then)
+    bool    loadBinary(const char *path, unsigned long long key);
+    bool    isMapped()   const { return map != NULL; }
+
+    int     size()       const { return count; }
+    int     getDropped() const { return dropped; }
+    //--  n photons left out by the caller (not offered to store() or append())
+    void    addDropped(int n)  { dropped += n; }
+    int     numRanges()  const { return offset.empty() ? 0 : offset.size() - 1; }
+    int     rangeBegin(int obj) const { return offset[obj]; }
+    int     rangeEnd  (int obj) const { return offset[obj + 1]; }
+    size_t  memoryUsage() const;
+
+    float         *pos;
+    float         *dir;
+    float         *power;
+    int           *obj;
+    unsigned char *plane;   //--  kd-tree splitting axis (0:X, 1:Y, 2:Z)
+
+  private :
+    CPhotonStore(const CPhotonStore &);
+    CPhotonStore &operator =(const CPhotonStore &);
+    void    grow(int n);
+    void    release();
+
+    void   *map;        //--  mapped file (loadBinary), copy on write
+    size_t  mapSize;
+    int     count;
+    int     allocated;
+    int     capacity;
+    int     dropped;
+    std::vector<int> offset;
+};
+
+//--  exactly like distance() in vector3.h
+inline double
+photonDistance(const Vector3 &p, const float *pos)
+{
+  double dx = p.x() - pos[0];
+  double dy = p.y() - pos[1];
+  double dz = p.z() - pos[2];
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+//--  result of a k-nearest query (max-heap on distance)
+typedef struct SNearestPhotons {
+  int     max;        //--  k
+  int     found;      //--  num of photons found (<= max)
+  double  sqRadius;   //--  squared distance to the farthest photon found
+  std::vector<int>    index;   //--  indices into the photon store
+  std::vector<double> sqDist;
+  SNearestPhotons(int k) : max(k), found(0), sqRadius(0.0), index(k+1), sqDist(k+1) {}
+} SNearestPhotons;
+
+//--  position and store index of a photon while balancing
+typedef struct SPhotonKey {
+  float pos[3];
+  int   index;
+} SPhotonKey;
+
+//--  subtree left for a worker thread while balancing
+typedef struct SBalanceTask {
+  int   index;
+  int   start;
+  int   end;
+  float bmin[3];
+  float bmax[3];
+} SBalanceTask;
+
+//--  balanced kd-tree over a contiguous range of the photon store
+//--  left-balanced and implicitly indexed : node i has children 2i and 2i+1,
+//--  node i is stored at begin + i - 1
+class CPhotonMap {
+  public :
+    CPhotonMap() : st(NULL), begin(0), num(0) {}
+
+    //--  balance photons [first, last) of the store in place
+    //--  subtrees below the top levels are balanced on nthreads workers
+    void    build(CPhotonStore *store, int first, int last, int nthreads = 1);
+    //--  photons [first, last) already balanced by build() (copied range)
+    void    attach(CPhotonStore *store, int first, int last)
+            { st = store; begin = first; num = last - first; }
+    int     size() const { return num; }
+
+    //--  fixed radius query : visit(index, dist) for every photon closer than radius
+    template <class Visitor>
+    void    locate(const Vector3 &p, double radius, Visitor &visit) const;
+
+    //--  k-nearest query within maxRadius
+    void    nearest(const Vector3 &p, double maxRadius, SNearestPhotons &np) const;
+
+    //--  closest photon within maxRadius for which accept(index) holds
+    //--  -1 if there is none
+    template <class Accept>
+    int     closest(const Vector3 &p, double maxRadius, Accept &accept) const;
+
+  private :
+    void    balanceSegment(std::vector<SPhotonKey> &porg, std::vector<int> &pbal,
+                           int index, int start, int end,
+                           const float *bmin, const float *bmax,
+                           int depth, std::vector<SBalanceTask> *defer);
+    static void balanceTask(int task, int thread, void *arg);
+    void    locateNearest(const Vector3 &p, int node, SNearestPhotons &np) const;
+    static void siftDown(SNearestPhotons &np, int k);
+
+    CPhotonStore *st;
+    int           begin;
+    int           num;
+};
+
+template <class Visitor> void
+CPhotonMap::locate(const Vector3 &p, double radius, Visitor &visit) const
+{
+  const double pc[3] = { p.x(), p.y(), p.z() };
+
+  int stack[64];
+  int sp   = 0;
+  int node = 1;
+  int visited = 0, accepted = 0;
+
+  while (true) {
+    //--  descend to the near side, postpone the far side if the plane is within radius
+    while (node <= num) {
+      const int    idx   = begin + node - 1;
+      const float *pp    = &st->pos[3 * idx];
+      int          axis  = st->plane[idx];
+      double delta = pc[axis] - pp[axis];
+
+      int near_node = 2 * node + (delta < 0.0 ? 0 : 1);
+      if (fabs(delta) < radius) { stack[sp++] = near_node ^ 1; }
+
+      double dist = photonDistance(p, pp);
+      if (dist < radius) { visit(idx, dist); accepted++; }
+      visited++;
+
+      node = near_node;
+    }
+    if (sp == 0) break;
+    node = stack[--sp];
+  }
+  statAdd(STAT_GATHER_VISITED,  visited);
+  statAdd(STAT_GATHER_ACCEPTED, accepted);
+}
+
+template <class Accept> int
+CPhotonMap::closest(const Vector3 &p, double maxRadius, Accept &accept) const
+{
+  const double pc[3] = { p.x(), p.y(), p.z() };
+
+  int    stack[64];
+  double split[64];     //--  squared distance to the plane of the postponed side
+  int    sp   = 0;
+  int    node = 1;
+  int    best = -1;
+  double best_d2 = maxRadius * maxRadius;
+  int    visited = 0;
+
+  while (true) {
+    while (node <= num) {
+      const int    idx   = begin + node - 1;
+      const float *pp    = &st->pos[3 * idx];
+      int          axis  = st->plane[idx];
+      double delta = pc[axis] - pp[axis];
+
+      int near_node = 2 * node + (delta < 0.0 ? 0 : 1);
+      if (delta * delta < best_d2) { stack[sp] = near_node ^ 1; split[sp++] = delta * delta; }
+
+      double dx = pc[0] - pp[0];
+      double dy = pc[1] - pp[1];
+      double dz = pc[2] - pp[2];
+      double d2 = dx * dx + dy * dy + dz * dz;
+      if (d2 < best_d2 && accept(idx)) { best = idx; best_d2 = d2; }
+      visited++;
+
+      node = near_node;
+    }
+    //--  sides farther than the best photon found since they were postponed
+    while (sp > 0 && split[sp - 1] >= best_d2) sp--;
+    if (sp == 0) break;
+    node = stack[--sp];
+  }
+  statAdd(STAT_GATHER_VISITED, visited);
+  return best;
+}
+
+#endif // __PHOTONMAP_H__
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <x86intrin.h>
+
+#include "tracer.h"
+#include "renderer.h"
+#include "threads.h"
+#include "packet.h"
+#include "wavefront.h"
+
+int  tileSize   = 16;   //--  Tile Edge Length in Pixels
+bool usePackets = true; //--  trace primary rays as SIMD packets
+CCostMap *costMap = NULL; //--  per pixel cost of renderFrame(), NULL : off
+int   aaSamples    = 0;     //--  Adaptive Supersampling : Base Samples per Pixel (0 : off)
+int   aaMaxSamples = 64;    //--  Max Samples of a Pixel
+float aaThreshold  = 0.02;  //--  Contrast to a Neighbour or Noise that Asks for More
+
+//--  camera path of a pixel between the generations of renderTileWave()
+typedef struct SWavePixel {
+  Vector3 ray;
+  Vector3 from;
+  Vector3 pnt;
+  SIntersectionStat istat;
+  float   refractive;
+  int     ref;
+  bool    visible;    //--  ended on a surface that is lit
+} SWavePixel;
+
+//--  buffers of one worker, allocated once per frame
+typedef struct SWaveTile {
+  CWaveQueue cur, next;
+  std::vector<SWavePixel> px;
+  SWaveTile(int n) : cur(n), next(n), px(n) {}
+} SWaveTile;
+
+typedef struct STileJob {
+  CImage *img;
+  int     tilesX;
+  bool    cost;       //--  fill costMap
+  std::vector<SWaveTile*> waves;   //--  per thread (useWavefront)
+} STileJob;
+
+//--  calcPixelColor() with what it cost : the counters of this thread
+//--  before and after, and the time stamp counter
+static void
+renderPixelCost(CImage &img, int x, int y)
+{
+  SStatBlock *b = statBlock ? statBlock : statAcquire();
+  const SStatBlock before = *b;
+
+  unsigned long long c0 = __rdtsc();
+  img.setPixel(x, y, calcPixelColor(x, y));
+  unsigned long long c1 = __rdtsc();
+
+  const StatCount *n0 = before.count;
+  const StatCount *n1 = b->count;
+  StatCount rays = 0;
+  for (int c = STAT_RAY_PRIMARY; c <= STAT_RAY_SHADOW; c++) rays += n1[c] - n0[c];
+  StatCount depth = (n1[STAT_RAY_REFLECT] - n0[STAT_RAY_REFLECT])
+                  + (n1[STAT_RAY_REFRACT] - n0[STAT_RAY_REFRACT]);
+
+  costMap->set(x, y, COST_CYCLES,  c1 - c0);
+  costMap->set(x, y, COST_RAYS,    rays);
+  costMap->set(x, y, COST_DEPTH,   depth);
+  costMap->set(x, y, COST_PHOTONS, n1[STAT_GATHER_VISITED] - n0[STAT_GATHER_VISITED]);
+}
+
+//--  the camera paths of a tile a generation at a time : primary rays,
+//--  then the reflections and refractions of all pixels that hit a mirror
+//--  or glass, each generation traced as one sorted CWaveQueue; the steps
+//--  of a path are those of visiblePoint(), the same image
+static void
+renderTileWave(CImage &img, SWaveTile &wt, int x0, int y0, int x1, int y1)
+{
+  const int w = x1 - x0;
+  const int n = w * (y1 - y0);
+  CWaveQueue *cur = &wt.cur, *next = &wt.next;
+
+  cur->clear();
+  for (int k = 0; k < n; k++) {
+    SWavePixel &p = wt.px[k];
+    p.ray        = primaryRay(x0 + k % w, y0 + k / w);
+    p.from       = gOrigin;
+    p.refractive = 1.0;
+    p.ref        = 0;
+    p.visible    = false;
+    cur->push(p.ray, p.from, k);
+  }
+  statAdd(STAT_RAY_PRIMARY, n);
+
+  while (cur->size() > 0) {
+    cur->trace();
+    next->clear();
+    for (int i = 0; i < cur->size(); i++) {
+      SWavePixel &p = wt.px[cur->item(i)];
+      p.istat = cur->hit(i);
+      if (p.istat.dist >= NOT_INTERSECTED) continue;
+      p.pnt = p.from + p.ray * p.istat.dist;
+
+      const int optics = p.istat.obj->getOptics();
+      if (optics == OPT_NONE || p.ref >= reflection_limit) { p.visible = true; continue; }
+      statAdd(optics == OPT_REFLECT ? STAT_RAY_REFLECT : STAT_RAY_REFRACT);
+      if (optics == OPT_REFLECT) p.ray = reflect(p.istat, p.pnt, p.ray, p.from);
+      else                       p.ray = refract(p.istat, p.pnt, p.ray, p.from, p.refractive);
+      p.ref++;
+      p.from = p.pnt;
+      next->push(p.ray, p.from, cur->item(i));
+    }
+    std::swap(cur, next);
+  }
+
+  for (int k = 0; k < n; k++) {
+    const SWavePixel &p = wt.px[k];
+    img.setPixel(x0 + k % w, y0 + k / w, p.visible ? lightPoint(p.pnt, p.istat) : Vector3());
+  }
+}
+
+static void
+renderTile(int task, int thread, void *arg)
+{
+  STileJob *job = (STileJob *)arg;
+  CImage   &img = *job->img;
+
+  int x0 = (task % job->tilesX) * tileSize;
+  int y0 = (task / job->tilesX) * tileSize;
+  int x1 = std::min(x0 + tileSize, img.getWidth());
+  int y1 = std::min(y0 + tileSize, img.getHeight());
+
+  if (job->cost) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) renderPixelCost(img, x, y);
+    }
+    return;
+  }
+
+  if (useWavefront) {
+    renderTileWave(img, *job->waves[thread], x0, y0, x1, y1);
+    return;
+  }
+
+  if (!usePackets) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        img.setPixel(x, y, calcPixelColor(x, y));
+      }
+    }
+    return;
+  }
+
+  //--  primary rays are coherent : trace them PACKET_SIZE pixels at a time
+  SRayPacket        rp;
+  SIntersectionStat istat[PACKET_SIZE];
+  Vector3           ray[PACKET_SIZE];
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x += PACKET_SIZE) {
+      rp.num = std::min(PACKET_SIZE, x1 - x);
+      statAdd(STAT_RAY_PRIMARY, rp.num);
+      for (int i = 0; i < rp.num; i++) {
+        ray[i] = primaryRay(x + i, y);
+        setPacketRay(rp, i, ray[i], gOrigin);
+      }
+      raytracePacket(rp, istat);
+      for (int i = 0; i < rp.num; i++) {
+        img.setPixel(x + i, y, shadePixel(ray[i], istat[i]));
+      }
+    }
+  }
+}
+
+void
+renderFrame(CImage &img)
+{
+  if (aaSamples > 0 && !costMap) { renderAdaptive(img); return; }
+
+  STileJob job;
+  job.img    = &img;
+  job.tilesX = (img.getWidth()  + tileSize - 1) / tileSize;
+  job.cost   = costMap && costMap->getWidth()  == img.getWidth()
+                       && costMap->getHeight() == img.getHeight();
+  int tilesY = (img.getHeight() + tileSize - 1) / tileSize;
+
+  StatCount t0 = statClock();
+  if (useWavefront) {
+    for (int t = 0; t < numThreads(); t++) job.waves.push_back(new SWaveTile(tileSize * tileSize));
+  }
+  runTasks(job.tilesX * tilesY, numThreads(), renderTile, &job);
+  for (size_t t = 0; t < job.waves.size(); t++) delete job.waves[t];
+  statAdd(STAT_TIME_RENDER, statClock() - t0);
+}
+
+typedef struct SPixelJob {
+  const int *xy;
+  int        num;
+  Vector3   *rgb;
+} SPixelJob;
+
+//--  pixels per task : a few rows of a tile
+static const int pixel_chunk = 64;
+
+static void
+renderPixelChunk(int task, int, void *arg)
+{
+  SPixelJob *job = (SPixelJob *)arg;
+  int end = std::min(job->num, (task + 1) * pixel_chunk);
+  for (int i = task * pixel_chunk; i < end; i++) {
+    job->rgb[i] = calcPixelColor(job->xy[2 * i], job->xy[2 * i + 1]);
+  }
+}
+
+void
+renderPixels(const int *xy, int n, Vector3 *rgb)
+{
+  SPixelJob job;
+  job.xy  = xy;
+  job.num = n;
+  job.rgb = rgb;
+
+  StatCount t0 = statClock();
+  runTasks((n + pixel_chunk - 1) / pixel_chunk, numThreads(), renderPixelChunk, &job);
+  statAdd(STAT_TIME_RENDER, statClock() - t0);
+}
+
+//--------------------
+//  Adaptive Supersampling
+//--------------------
+
+//--  luminance below this is as dark as black to the threshold
+static const double aa_floor = 0.02;
+
+typedef struct SAaPixel {
+  double sum[3];
+  double lum2;        //--  sum of the squared luminances
+  int    n;
+} SAaPixel;
+
+typedef struct SAaJob {
+  int width;
+  int height;
+  std::vector<SAaPixel> px;
+  std::vector<int>      add;    //--  samples to trace in this round
+} SAaJob;
+
+static inline double
+luminance(const double *rgb)
+{
+  return 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+}
+
+//--  mean luminance of a pixel
+static inline double
+aaMean(const SAaPixel &p)
+{
+  return luminance(p.sum) / p.n;
+}
+
+//--  sample s of pixel (x, y) : the R2 sequence shifted by a hash of the
+//--  pixel, so neighbours do not share a pattern and any prefix is spread
+static void
+samplePos(int x, int y, int s, float &sx, float &sy)
+{
+  unsigned int h = (unsigned int)x * 0x8da6b343u ^ (unsigned int)y * 0xd8163841u;
+  h ^= h >> 15; h *= 0x2c1b3c6du; h ^= h >> 12;
+  double u, v;
+  sampleR2(s, (h & 0xffff) / 65536.0, (h >> 16) / 65536.0, u, v);
+  sx = x + (float)u;
+  sy = y + (float)v;
+}
+
+static void
+aaSampleRow(int y, int, void *arg)
+{
+  SAaJob *job = (SAaJob *)arg;
+  for (int x = 0; x < job->width; x++) {
+    SAaPixel &p = job->px[y * job->width + x];
+    const int add = job->add[y * job->width + x];
+    for (int s = p.n; s < p.n + add; s++) {
+      float sx, sy;
+      samplePos(x, y, s, sx, sy);
+      Vector3 c = calcPixelColor(sx, sy);
+      double rgb[3] = { c[0], c[1], c[2] };
+      double l = luminance(rgb);
+      for (int k = 0; k < 3; k++) p.sum[k] += rgb[k];
+      p.lum2 += l * l;
+    }
+    p.n += add;
+  }
+}
+
+//--  standard error of the mean luminance above aaThreshold (relative)
+static inline bool
+aaNoisy(const SAaPixel &p)
+{
+  const double m   = aaMean(p);
+  const double var = std::max(0.0, p.lum2 / p.n - m * m);
+  return sqrt(var / p.n) > aaThreshold * (m + aa_floor);
+}
+
+//--  the samples of a pixel are doubled while it is noisy, or while a
+//--  neighbour with more samples is : an edge or a highlight that the
+//--  few samples of a pixel all missed is found from the next pixel
+static void
+aaMarkRow(int y, int, void *arg)
+{
+  static const int nx[4] = { -1, 1, 0, 0 };
+  static const int ny[4] = { 0, 0, -1, 1 };
+  SAaJob *job = (SAaJob *)arg;
+  const int w = job->width;
+  for (int x = 0; x < w; x++) {
+    const SAaPixel &p = job->px[y * w + x];
+    int &add = job->add[y * w + x];
+    add = 0;
+    if (p.n >= aaMaxSamples) continue;
+
+    bool more = aaNoisy(p);
+    for (int k = 0; k < 4 && !more; k++) {
+      int qx = x + nx[k], qy = y + ny[k];
+      if (qx < 0 || qy < 0 || qx >= w || qy >= job->height) continue;
+      const SAaPixel &q = job->px[qy * w + qx];
+      more = q.n > p.n && aaNoisy(q);
+    }
+    if (more) add = std::min(p.n, aaMaxSamples - p.n);
+  }
+}
+
+void
+renderAdaptive(CImage &img)
+{
+  SAaJob job;
+  job.width  = img.getWidth();
+  job.height = img.getHeight();
+  const int npx = job.width * job.height;
+  SAaPixel zero = { { 0.0, 0.0, 0.0 }, 0.0, 0 };
+  job.px .assign(npx, zero);
+  job.add.assign(npx, std::max(1, std::min(aaSamples, aaMaxSamples)));
+
+  //--  rows are traced apart from the marks of the round : the samples
+  //--  do not depend on the thread count
+  StatCount t0 = statClock();
+  runTasks(job.height, numThreads(), aaSampleRow, &job);
+  while (true) {
+    runTasks(job.height, numThreads(), aaMarkRow, &job);
+    bool any = false;
+    for (int i = 0; i < npx && !any; i++) any = job.add[i] > 0;
+    if (!any) break;
+    runTasks(job.height, numThreads(), aaSampleRow, &job);
+  }
+
+  for (int y = 0; y < job.height; y++) {
+    for (int x = 0; x < job.width; x++) {
+      const SAaPixel &p = job.px[y * job.width + x];
+      img.setPixel(x, y, Vector3(p.sum[0] / p.n, p.sum[1] / p.n, p.sum[2] / p.n));
+    }
+  }
+  statAdd(STAT_TIME_RENDER, statClock() - t0);
+}
@@ -0,0 +1,34 @@
+//renderer.h
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include "image.h"
+#include "costmap.h"
+
+extern int  tileSize;   //--  Tile Edge Length in Pixels
+extern bool usePackets; //--  trace primary rays as SIMD packets
+extern CCostMap *costMap; //--  per pixel cost of renderFrame() (image size), NULL : off
+extern int   aaSamples;    //--  Adaptive Supersampling : Base Samples per Pixel (0 : off)
+extern int   aaMaxSamples; //--  Max Samples of a Pixel
+extern float aaThreshold;  //--  Contrast to a Neighbour or Noise that Asks for More
+
+//--  trace the whole frame into img with calcPixelColor()
+//--  tiles are shared among nrThreads workers with work stealing,
+//--  the result does not depend on the thread count
+//--  with costMap the pixels go one by one through calcPixelColor()
+//--  with aaSamples > 0 (and no costMap) through renderAdaptive()
+//--  with useWavefront the secondary rays of a tile go a generation at a
+//--  time through CWaveQueue (same image)
+void renderFrame(CImage &img);
+//--  colours of n pixels through calcPixelColor() (xy : x, y of each),
+//--  in chunks shared among nrThreads workers like the tiles of
+//--  renderFrame() : the scattered pixels of a progressive view
+void renderPixels(const int *xy, int n, Vector3 *rgb);
+//--  aaSamples per pixel, then rounds that double the samples of the pixels
+//--  whose mean is uncertain by more than aaThreshold (relative), or that
+//--  are next to such a pixel with more samples, up to aaMaxSamples
+//--  the pixel covers [x, x+1); aaSamples == aaMaxSamples : uniform
+//--  the samples are counted as STAT_RAY_PRIMARY
+void renderAdaptive(CImage &img);
+
+#endif // __RENDERER_H__
@@ -0,0 +1,34 @@
+//rng.h
+#ifndef __RNG_H__
+#define __RNG_H__
+
+#include <stdint.h>
+
+//--  random number stream keyed by (seed, stream id)
+//--  every photon gets its own stream (stream id = photon index), so the
+//--  sequence of a photon does not depend on which thread traces it
+class CRandom {
+  public :
+    CRandom(uint64_t seed, uint64_t stream) {
+      state = mix(seed + 0x9E3779B97F4A7C15ULL) ^ mix(stream * 0xD1B54A32D192ED03ULL + 1);
+    }
+
+    //--  splitmix64 step
+    uint64_t next() {
+      state += 0x9E3779B97F4A7C15ULL;
+      return mix(state);
+    }
+    //--  [0, 1)
+    double   uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+  private :
+    static uint64_t mix(uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      return z ^ (z >> 31);
+    }
+
+    uint64_t state;
+};
+
+#endif // __RNG_H__
@@ -0,0 +1,146 @@
+//sampler.h
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include "rng.h"
+
+//--  how the random numbers of a photon are drawn
+enum {
+  SAMPLER_LEGACY = 0,   //--  CRandom, directions from a cube, light point folded below Light
+  SAMPLER_RANDOM,       //--  CRandom, sphere and hemisphere mappings
+  SAMPLER_HALTON,       //--  scrambled Halton points over the sample index
+  SAMPLER_NUM
+};
+
+//--  dimension d of the Halton sequence uses primes[d], CRandom beyond
+static const int halton_dims = 16;
+
+//--  the numbers of sample `index` of a sequence, one dimension per call
+//--  the CRandom stream is (seed, index) : SAMPLER_LEGACY and
+//--  SAMPLER_RANDOM give the very numbers of CRandom(seed, index)
+class CSampler {
+  public :
+    CSampler(int type, uint64_t s, uint64_t index)
+      : kind(type), idx(index), dim(0), seed(s), rng(s, index) {}
+
+    int      type() const { return kind; }
+
+    //--  [0, 1)
+    double   next1D() {
+      const int d = dim++;
+      if (kind == SAMPLER_HALTON && d < halton_dims) return halton(d);
+      return rng.uniform();
+    }
+
+  private :
+    static uint64_t mix(uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      return z ^ (z >> 31);
+    }
+
+    //--  digits of n in base B (a constant : no division instructions),
+    //--  exact for n < 2^40 (B^digits fits in 64 bits)
+    //--  each shifted by the next number of an LCG seeded by key
+    template <unsigned B> static double
+    scrambled(uint64_t n, uint64_t key) {
+      uint64_t digits = 0, scale = 1;
+      while (n > 0) {
+        key = key * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned digit = (unsigned)(n % B) + (unsigned)(((key >> 32) * B) >> 32);
+        n /= B;
+        digits = digits * B + (digit < B ? digit : digit - B);
+        scale *= B;
+      }
+      //--  scrambled zeros beyond the digits of n : uniform below 1 / scale
+      double tail = (mix(key) >> 11) * (1.0 / 9007199254740992.0);
+      return (digits + tail) / scale;
+    }
+
+    //--  radical inverse of idx in base primes[d], each digit position
+    //--  shifted by its own random amount (random digit scrambling) :
+    //--  still a (0,1)-sequence per dimension, no longer aligned across
+    //--  dimensions or seeds
+    double   halton(int d) const {
+      static const int primes[halton_dims] = {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53
+      };
+      uint64_t key = mix(seed * 0x9E3779B97F4A7C15ULL + d);
+      if (d == 0) {
+        //--  base 2 : the shifts are an xor of the reversed bits
+        uint64_t n = idx;
+        n = ((n >> 1) & 0x5555555555555555ULL) | ((n & 0x5555555555555555ULL) << 1);
+        n = ((n >> 2) & 0x3333333333333333ULL) | ((n & 0x3333333333333333ULL) << 2);
+        n = ((n >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((n & 0x0F0F0F0F0F0F0F0FULL) << 4);
+        n = ((n >> 8) & 0x00FF00FF00FF00FFULL) | ((n & 0x00FF00FF00FF00FFULL) << 8);
+        n = ((n >> 16) & 0x0000FFFF0000FFFFULL) | ((n & 0x0000FFFF0000FFFFULL) << 16);
+        n = (n >> 32) | (n << 32);
+        return ((n ^ key) >> 11) * (1.0 / 9007199254740992.0);
+      }
+      double r;
+      switch (primes[d]) {
+        case  3 : r = scrambled< 3>(idx, key); break;
+        case  5 : r = scrambled< 5>(idx, key); break;
+        case  7 : r = scrambled< 7>(idx, key); break;
+        case 11 : r = scrambled<11>(idx, key); break;
+        case 13 : r = scrambled<13>(idx, key); break;
+        case 17 : r = scrambled<17>(idx, key); break;
+        case 19 : r = scrambled<19>(idx, key); break;
+        case 23 : r = scrambled<23>(idx, key); break;
+        case 29 : r = scrambled<29>(idx, key); break;
+        case 31 : r = scrambled<31>(idx, key); break;
+        case 37 : r = scrambled<37>(idx, key); break;
+        case 41 : r = scrambled<41>(idx, key); break;
+        case 43 : r = scrambled<43>(idx, key); break;
+        case 47 : r = scrambled<47>(idx, key); break;
+        default : r = scrambled<53>(idx, key); break;
+      }
+      return r < 1.0 ? r : 0.99999999999999989;
+    }
+
+    int      kind;
+    uint64_t idx;
+    int      dim;
+    uint64_t seed;
+    CRandom  rng;
+};
+
+//--  uniform direction on the unit sphere
+inline void
+sampleSphere(double u, double v, double *d)
+{
+  const double z = 1.0 - 2.0 * u;
+  const double r = sqrt(fmax(0.0, 1.0 - z * z));
+  const double phi = 2.0 * M_PI * v;
+  d[0] = r * cos(phi);
+  d[1] = r * sin(phi);
+  d[2] = z;
+}
+
+//--  uniform direction on the hemisphere around axis (0, 1 or 2), sign -1
+//--  for the negative side; the axis component is never 0
+inline void
+sampleHemisphere(double u, double v, int axis, double sign, double *d)
+{
+  const double h = 1.0 - u;                        //--  (0, 1]
+  const double r = sqrt(fmax(0.0, 1.0 - h * h));
+  const double phi = 2.0 * M_PI * v;
+  d[axis]           = sign * h;
+  d[(axis + 1) % 3] = r * cos(phi);
+  d[(axis + 2) % 3] = r * sin(phi);
+}
+
+//--  point s of the R2 sequence shifted by (ox, oy), in [0, 1)^2
+//--  (pixel samples : any prefix is well spread)
+inline void
+sampleR2(int s, double ox, double oy, double &u, double &v)
+{
+  u = ox + 0.7548776662466927 * (s + 1);
+  v = oy + 0.5698402909980532 * (s + 1);
+  u -= floor(u);
+  v -= floor(v);
+}
+
+#endif // __SAMPLER_H__
@@ -0,0 +1,80 @@
+#include "scene.h"
+#include "mesh.h"
+
+SScene scene;
+
+int
+SScene::add(int tp, const float *cod)
+{
+  const int idx = type.size();
+
+  SMaterial mat;
+  for (int i = 0; i < 3; i++) mat.color[i] = 1.0;
+  mat.optic      = OPT_NONE;
+  mat.refractive = 1.0;
+
+  int sl = 0;
+  switch (tp) {
+  case TYPE_SPHERE :
+    sl = sphereObj.size();
+    sphereX.push_back(cod[0]);
+    sphereY.push_back(cod[1]);
+    sphereZ.push_back(cod[2]);
+    sphereR.push_back(cod[3]);
+    sphereObj.push_back(idx);
+    break;
+  case TYPE_PLANE :
+    sl = planeObj.size();
+    planeAxis.push_back((int)cod[0]);
+    planeDist.push_back(cod[1]);
+    planeObj.push_back(idx);
+    break;
+  case TYPE_TRIANGLE :
+    sl = meshObj.size();
+    meshX.push_back(cod[0]);
+    meshY.push_back(cod[1]);
+    meshZ.push_back(cod[2]);
+    meshScale.push_back(cod[3]);
+    meshData.push_back(NULL);
+    meshObj.push_back(idx);
+    break;
+  }
+
+  type.push_back(tp);
+  slot.push_back(sl);
+  material.push_back(mat);
+  return idx;
+}
+
+void
+SScene::clear()
+{
+  type.clear();
+  slot.clear();
+  material.clear();
+
+  sphereX.clear(); sphereY.clear(); sphereZ.clear(); sphereR.clear();
+  sphereObj.clear();
+  planeAxis.clear(); planeDist.clear();
+  planeObj.clear();
+  meshX.clear(); meshY.clear(); meshZ.clear(); meshScale.clear();
+  meshData.clear();
+  meshObj.clear();
+}
+
+unsigned long long
+SScene::hash(unsigned long long h) const
+{
+  h = fnvHash(type, h);
+  h = fnvHash(slot, h);
+  h = fnvHash(material, h);
+  h = fnvHash(sphereX, h); h = fnvHash(sphereY, h); h = fnvHash(sphereZ, h);
+  h = fnvHash(sphereR, h);
+  h = fnvHash(planeAxis, h); h = fnvHash(planeDist, h);
+  h = fnvHash(meshX, h); h = fnvHash(meshY, h); h = fnvHash(meshZ, h);
+  h = fnvHash(meshScale, h);
+  for (size_t m = 0; m < meshData.size(); m++) {
+    if (meshData[m]) h = meshData[m]->hash(h);
+  }
+  return h;
+}
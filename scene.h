@@ -0,0 +1,115 @@
+//scene.h
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <vector>
+#include <cstddef>
+#include "vector3.h"
+
+using WebCore::Vector3;
+
+#define TYPE_SPHERE   0
+#define TYPE_PLANE    1
+#define TYPE_TRIANGLE 2
+
+#define OPT_NONE 0
+#define OPT_REFLECT 1
+#define OPT_REFRACT 2
+
+#define NOT_INTERSECTED (1.0e6)
+
+class CMesh;
+
+//--  64 bit FNV-1a over n bytes, chained through h
+#define FNV_BASIS 14695981039346656037ULL
+
+inline unsigned long long
+fnvHash(const void *data, size_t n, unsigned long long h = FNV_BASIS)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+template <typename T> inline unsigned long long
+fnvHash(const std::vector<T> &v, unsigned long long h)
+{
+  return v.empty() ? h : fnvHash(&v[0], sizeof(T) * v.size(), h);
+}
+
+//--  surface properties of one object
+typedef struct SMaterial {
+  float color[3];
+  int   optic;          //--  OPT_NONE, OPT_REFLECT or OPT_REFRACT
+  float refractive;
+} SMaterial;
+
+//--  scene storage : one contiguous array per type and field, in the layout
+//--  the intersection loops read them.  An object is a (type, slot) pair,
+//--  CObj is a view on it by object index.
+typedef struct SScene {
+  //--  per object, indexed by object index
+  std::vector<int>       type;
+  std::vector<int>       slot;        //--  index in the arrays of its type
+  std::vector<SMaterial> material;
+
+  //--  spheres : center, radius
+  std::vector<float>  sphereX, sphereY, sphereZ, sphereR;
+  std::vector<int>    sphereObj;      //--  object index
+  //--  axis aligned planes : axis (0:X, 1:Y, 2:Z), distance from origin
+  std::vector<int>    planeAxis;
+  std::vector<float>  planeDist;
+  std::vector<int>    planeObj;
+  //--  mesh instances : offset, uniform scale, triangles (not owned)
+  std::vector<float>  meshX, meshY, meshZ, meshScale;
+  std::vector<CMesh*> meshData;
+  std::vector<int>    meshObj;
+
+  int  size() const { return type.size(); }
+  //--  cod : sphere {center, radius}, plane {axis, distance},
+  //--        triangle mesh {offset, scale}; returns the object index
+  int  add(int tp, const float *cod);
+  void clear();
+  //--  geometry and materials of every object (with the mesh triangles)
+  unsigned long long hash(unsigned long long h = FNV_BASIS) const;
+} SScene;
+
+extern SScene scene;
+
+//--  ray-sphere intersection, same arithmetic as the original
+//--  CObj::calcSphereIntersection() : dot products in real, quadratic in float
+inline real
+intersectSphere(float cx, float cy, float cz, float radius, const Vector3 &r, const Vector3 &o)
+{
+  //  s = Sphere Center Translated into Coordinate Frame of Ray Origin
+  Vector3 center(cx, cy, cz);
+  Vector3 s = center - o;
+
+  //Intersection of Sphere and Line     =       Quadratic Function of Distance
+  float A = dot(r,r);
+  float B = -2.0 * dot(s,r);
+  float C = dot(s,s) - radius * radius;
+  float D = B * B - 4 * A * C;
+
+  //  二次方程式に解がある場合のみ，距離が算出できる
+  if (D > 0.0) {
+    float sign = (C < -0.00001) ? 1 : -1;
+    return (-B + sign*sqrt(D))/(2*A);
+  }
+  return NOT_INTERSECTED;
+}
+
+//--  ray-plane intersection (axis aligned), in real
+inline real
+intersectPlane(int axis, float dist, const Vector3 &r, const Vector3 &o)
+{
+  if (r[axis] != 0.0){                        //Parallel Ray -> No Intersection
+    return  (dist - o[axis]) / r[axis];       //Solve Linear Equation (rx = p-o)
+  }
+  return NOT_INTERSECTED;
+}
+
+#endif // __SCENE_H__
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tracer.h"
+#include "shadow.h"
+
+int   nrShadowPhotons = 0;    //--  Photons of the Shadow Map (0 : a shadow ray per pixel)
+float shadowRadius    = 0.05; //--  Shadow Map Cell Size (a distance)
+
+CPhotonStore shadowStore;
+CShadowGrid  shadowGrid;
+
+//--------------------
+//  Shadow Grid
+//--------------------
+
+//--  cell coordinates within +-2^20 (21 bits each)
+static const int cell_range = 1 << 20;
+
+uint64_t
+CShadowGrid::cellKey(const float *p) const
+{
+  uint64_t key = 1ULL << 63;
+  for (int k = 0; k < 3; k++) {
+    double c = floor(p[k] * scale);
+    if (c < -cell_range || c >= cell_range) return 0;
+    key |= (uint64_t)((int)c + cell_range) << (21 * k);
+  }
+  return key;
+}
+
+//--  first slot of key in the table : rows along x hashed, cells of a
+//--  row on consecutive slots (the neighbours of a cell share cache lines)
+size_t
+CShadowGrid::slot(uint64_t key) const
+{
+  uint64_t row = key >> 21;
+  row ^= row >> 29;
+  row *= 0xBF58476D1CE4E5B9ULL;
+  row ^= row >> 32;
+  return (size_t)((row + (key & (2 * cell_range - 1))) & mask);
+}
+
+long
+CShadowGrid::find(uint64_t key) const
+{
+  for (size_t s = slot(key); keys[s]; s = (s + 1) & mask) {
+    if (keys[s] == key) return (long)s;
+  }
+  return -1;
+}
+
+void
+CShadowGrid::build(const CPhotonStore &st, float cell)
+{
+  clear();
+  if (st.size() == 0) return;
+  scale = 1.0f / cell;
+
+  //--  at most one cell per photon : the table stays under half full
+  size_t size = 1024;
+  while (size < 2 * (size_t)st.size()) size *= 2;
+  mask = size - 1;
+  keys .assign(size, 0);
+  kinds.assign(size, 0);
+
+  for (int i = 0; i < st.size(); i++) {
+    uint64_t key = cellKey(&st.pos[3 * i]);
+    if (!key) continue;
+    size_t s = slot(key);
+    while (keys[s] && keys[s] != key) s = (s + 1) & mask;
+    keys [s]  = key;
+    kinds[s] |= st.power[3 * i] > 0.0f ? 1 : 2;
+  }
+
+  //--  each cell gets the kinds of its 26 neighbours : the photons within
+  //--  about a cell of any point in it (cells at the edge of a shadow or
+  //--  where walls meet are mixed, not wrong)
+  const uint64_t field = 2 * cell_range - 1;
+  std::vector<unsigned char> around(kinds);
+  for (size_t s = 0; s < size; s++) {
+    if (!keys[s]) continue;
+    int c[3];
+    for (int k = 0; k < 3; k++) c[k] = (int)((keys[s] >> (21 * k)) & field);
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          const uint64_t x = c[0] + dx, y = c[1] + dy, z = c[2] + dz;
+          if ((x | y | z) > field) continue;     //--  out of range (negative too)
+          long t = find((1ULL << 63) | x | (y << 21) | (z << 42));
+          if (t >= 0) around[s] |= kinds[t];
+        }
+      }
+    }
+  }
+  kinds.swap(around);
+}
+
+int
+CShadowGrid::lookup(const Vector3 &p) const
+{
+  if (keys.empty()) return SHADOW_MIXED;
+  const float pc[3] = { (float)p.x(), (float)p.y(), (float)p.z() };
+  uint64_t key = cellKey(pc);
+  if (!key) return SHADOW_MIXED;
+  long s = find(key);
+  if (s < 0) return SHADOW_MIXED;
+  switch (kinds[s]) {
+    case 1  : return SHADOW_LIT;
+    case 2  : return SHADOW_DARK;
+    default : return SHADOW_MIXED;
+  }
+}
+
+int
+CShadowGrid::numCells() const
+{
+  int n = 0;
+  for (size_t s = 0; s < keys.size(); s++) n += keys[s] != 0;
+  return n;
+}
+
+//--------------------
+//  Shadow Photons
+//--------------------
+
+//--  surfaces a photon goes through before it is given up (it stops at
+//--  the first wall well before)
+static const int shadow_hits = 8;
+
+//--  uniform direction from the point Light (direct lighting has no light
+//--  radius), then every surface along the straight line
+static int
+emitShadowPhoton(CSampler &smp, CPhotonStore &st, std::vector<float> *)
+{
+  double d[3];
+  double u = smp.next1D();
+  double v = smp.next1D();
+  sampleSphere(u, v, d);
+  Vector3 ray(d[0], d[1], d[2]);
+  Vector3 from = Light;
+  statAdd(STAT_SHADOW_PHOTON);
+
+  const Vector3 lit ( 1.0,  1.0,  1.0);
+  const Vector3 dark(-1.0, -1.0, -1.0);
+  for (int k = 0; k < shadow_hits; k++) {
+    statAdd(STAT_RAY_PHOTON);
+    SIntersectionStat istat = raytrace(ray, from);
+    if (istat.dist >= NOT_INTERSECTED) return 0;
+
+    //--  glass and mirrors block direct lighting : nothing is lit there
+    Vector3 pnt = from + ray * istat.dist;
+    if (k > 0 || istat.obj->getOptics() != OPT_NONE) storePhoton(st, istat.obj, pnt, ray, dark);
+    else                                             storePhoton(st, istat.obj, pnt, ray, lit);
+    //--  the walls enclose the room : nothing behind them is seen
+    if (istat.obj->getType() == TYPE_PLANE) return 0;
+    from = pnt;
+  }
+  return 0;
+}
+
+void
+emitShadowPhotons()
+{
+  shadowStore.clear();
+  shadowGrid.clear();
+  if (nrShadowPhotons <= 0) return;
+  StatCount t0 = statClock();
+
+  //--  streams apart from those of emitPhotons() and emitCaustics()
+  emitPhotonsInto(shadowStore, emitShadowPhoton, photonSampler, stream_shadow, nrShadowPhotons);
+  statAdd(STAT_TIME_EMIT, statClock() - t0);
+
+  t0 = statClock();
+  shadowGrid.build(shadowStore, shadowRadius);
+  statAdd(STAT_TIME_PHOTONMAP, statClock() - t0);
+}
@@ -0,0 +1,60 @@
+//shadow.h
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include "photonmap.h"
+
+extern int   nrShadowPhotons; //--  Photons of the Shadow Map (0 : a shadow ray per pixel)
+extern float shadowRadius;    //--  Shadow Map Cell Size (a distance)
+
+//--  visibility of Light (Jensen's shadow photons) : photons from the
+//--  point Light, a direct photon (power +1) at the first hit and a shadow
+//--  photon (power -1) at every surface behind it
+extern CPhotonStore shadowStore;
+
+//--  kinds of the photons in and next to each cell of a grid, the cells
+//--  that hold photons in an open addressing hash table : a lookup is one
+//--  probe, points in cells without photons get SHADOW_MIXED
+class CShadowGrid {
+  public :
+    CShadowGrid() : scale(0.0f), mask(0) {}
+
+    //--  cells of size cell
+    void    build(const CPhotonStore &st, float cell);
+    void    clear() { keys.clear(); kinds.clear(); mask = 0; }
+    int     lookup(const Vector3 &p) const;
+    int     numCells() const;
+    size_t  memoryUsage() const { return keys.capacity() * (sizeof(uint64_t) + 1); }
+
+  private :
+    //--  cell of p, 0 if out of range (no cell has key 0)
+    uint64_t cellKey(const float *p) const;
+    size_t   slot(uint64_t key) const;
+    //--  slot of key, -1 if the cell is not in the table
+    long     find(uint64_t key) const;
+
+    float   scale;        //--  1 / cell
+    uint64_t mask;        //--  table size - 1
+    std::vector<uint64_t> keys;
+    std::vector<unsigned char> kinds;   //--  1 : direct, 2 : shadow photons
+};
+
+extern CShadowGrid shadowGrid;
+
+//--  answers of shadowLookup()
+enum {
+  SHADOW_MIXED = 0,     //--  penumbra or no photons : cast the shadow ray
+  SHADOW_LIT,           //--  only direct photons around
+  SHADOW_DARK           //--  only shadow photons around
+};
+
+//--  nrShadowPhotons into shadowStore (none if nrShadowPhotons is 0)
+void    emitShadowPhotons();
+//--  photons around p (shadowGrid.lookup())
+inline int
+shadowLookup(const Vector3 &p) { return shadowGrid.lookup(p); }
+
+#endif // __SHADOW_H__
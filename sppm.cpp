@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tracer.h"
+#include "sppm.h"
+#include "caustic.h"
+#include "threads.h"
+
+float sppmAlpha = 0.7;      //--  Share of a Pass's Photons Kept in the Count (0..1)
+
+CSppm::CSppm(int w, int h)
+  : width(w), height(h), passes(0), photons(0), points(w * h)
+{
+}
+
+void
+CSppm::traceRow(int y, int, void *arg)
+{
+  CSppm *sp = (CSppm *)arg;
+  for (int x = 0; x < sp->width; x++) {
+    SSppmPoint &vp = sp->points[y * sp->width + x];
+    vp.obj    = -1;
+    vp.radius = sqRadius;
+    vp.count  = 0.0f;
+    for (int k = 0; k < 3; k++) vp.flux[k] = 0.0f;
+
+    Vector3 ray = primaryRay(x, y);
+    statAdd(STAT_RAY_PRIMARY);
+    Vector3 pnt;
+    SIntersectionStat istat;
+    if (!visiblePoint(ray, raytrace(ray, gOrigin), pnt, istat)) continue;
+
+    Vector3 N = surfaceNormal(istat, pnt, gOrigin);
+    vp.obj = istat.obj->getIndex();
+    for (int k = 0; k < 3; k++) {
+      vp.pos[k]    = pnt[k];
+      vp.normal[k] = N[k];
+    }
+  }
+}
+
+void
+CSppm::traceVisiblePoints()
+{
+  passes  = 0;
+  photons = 0;
+  runTasks(height, numThreads(), traceRow, this);
+}
+
+//--  photons of one pass around a visible point : count and flux
+//--  (power weighted by the incidence, like addPhotonEnergy())
+//--  store : photonStore, then causticStore (its power is already scaled
+//--  to the photons of emitPhotons(), so the two add up)
+typedef struct SSppmGather {
+  const CPhotonStore *store;
+  Vector3 N;
+  int     num;
+  Vector3 flux;
+  void operator ()(int i, double) {
+    const float *d = &store->dir[3 * i];
+    const float *e = &store->power[3 * i];
+    float weight = std::max(0.0f, -(float)(N[0] * d[0] + N[1] * d[1] + N[2] * d[2]));
+    flux += Vector3(e) * weight;
+    num++;
+  }
+} SSppmGather;
+
+void
+CSppm::updateRow(int y, int, void *arg)
+{
+  CSppm *sp = (CSppm *)arg;
+  for (int x = 0; x < sp->width; x++) {
+    SSppmPoint &vp = sp->points[y * sp->width + x];
+    if (vp.obj < 0) continue;
+
+    SSppmGather g;
+    g.store = &photonStore;
+    g.N     = Vector3(vp.normal);
+    g.num   = 0;
+    statAdd(STAT_GATHER_QUERIES);
+    photonMaps[vp.obj].locate(Vector3(vp.pos), vp.radius, g);
+    if (vp.obj < (int)causticMaps.size()) {
+      g.store = &causticStore;
+      causticMaps[vp.obj].locate(Vector3(vp.pos), vp.radius, g);
+    }
+    if (g.num == 0) continue;
+
+    //--  keep alpha of the new photons, shrink the radius to match
+    //--  and scale the flux to the smaller disk
+    float n     = vp.count + sppmAlpha * g.num;
+    float ratio = n / (vp.count + g.num);
+    vp.radius  *= sqrt(ratio);
+    vp.count    = n;
+    for (int k = 0; k < 3; k++) vp.flux[k] = (vp.flux[k] + g.flux[k]) * ratio;
+  }
+}
+
+void
+CSppm::pass()
+{
+  //--  new random streams every pass, for the photons and the caustic
+  //--  photons (emitCaustics() within emitPhotons()) alike
+  const int num_photon = nrPhotons * photonScale;
+  photonFirst = (uint64_t)passes * std::max(num_photon, nrCaustics);
+  emitPhotons();
+  photonFirst = 0;
+
+  runTasks(height, numThreads(), updateRow, this);
+  passes++;
+  photons += num_photon;
+}
+
+void
+CSppm::resolve(CImage &img) const
+{
+  //--  flux density per pass, scaled so that a single pass at the initial
+  //--  radius is as bright as gatherPhotons() : its cone weight (1 - d)
+  //--  averages 1 - 2/3 r over the disk
+  const float r0    = sqRadius;
+  const float scale = r0 * r0 * (1.0f - 2.0f / 3.0f * r0) / exposure;
+  for (int y = 0; y < height && y < img.getHeight(); y++) {
+    for (int x = 0; x < width && x < img.getWidth(); x++) {
+      const SSppmPoint &vp = points[y * width + x];
+      if (vp.obj < 0 || passes == 0) {
+        img.setPixel(x, y, Vector3());
+        continue;
+      }
+      float k = scale / (vp.radius * vp.radius * passes);
+      img.setPixel(x, y, Vector3(vp.flux) * k);
+    }
+  }
+}
+
+size_t
+CSppm::memoryUsage() const
+{
+  return points.size() * sizeof(SSppmPoint) + photonStore.memoryUsage() + causticStore.memoryUsage();
+}
@@ -0,0 +1,52 @@
+//sppm.h
+#ifndef __SPPM_H__
+#define __SPPM_H__
+
+#include <vector>
+#include <cstddef>
+#include "image.h"
+
+extern float sppmAlpha;     //--  Share of a Pass's Photons Kept in the Count (0..1)
+
+//--  surface seen by one pixel and its photon statistics
+typedef struct SSppmPoint {
+  float pos[3];
+  float normal[3];
+  int   obj;        //--  -1 : the camera path left the scene
+  float radius;     //--  gather radius, shrinks with the passes
+  float count;      //--  accumulated photon count N
+  float flux[3];    //--  accumulated flux tau (within radius)
+} SSppmPoint;
+
+//--  stochastic progressive photon mapping
+//--  the visible points are traced once; every pass() emits nrPhotons with
+//--  emitPhotons() (and the caustic map with nrCaustics), updates radius and
+//--  flux of each point and leaves the photons to be cleared by the next
+//--  pass : memory does not grow
+class CSppm {
+  public :
+    CSppm(int w, int h);
+
+    //--  camera paths of every pixel (same mapping as renderFrame())
+    void    traceVisiblePoints();
+    //--  one photon pass, on nrThreads workers
+    void    pass();
+    //--  radiance estimate of the passes so far
+    void    resolve(CImage &img) const;
+
+    int     numPasses()  const { return passes; }
+    long long numPhotons() const { return photons; }
+    size_t  memoryUsage() const;
+
+  private :
+    static void traceRow(int y, int thread, void *arg);
+    static void updateRow(int y, int thread, void *arg);
+
+    int width;
+    int height;
+    int passes;
+    long long photons;
+    std::vector<SSppmPoint> points;
+};
+
+#endif // __SPPM_H__
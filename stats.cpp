@@ -0,0 +1,127 @@
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+__thread SStatBlock *statBlock = NULL;
+
+//--  every block ever handed out, and the ones of exited threads
+static std::vector<SStatBlock*> statBlocks;
+static std::vector<SStatBlock*> statSpare;
+static pthread_mutex_t statLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   statKey;
+static pthread_once_t  statOnce = PTHREAD_ONCE_INIT;
+
+//--  thread exit : the block keeps its counts and goes back to the pool
+static void
+statRelease(void *b)
+{
+  pthread_mutex_lock(&statLock);
+  statSpare.push_back((SStatBlock *)b);
+  pthread_mutex_unlock(&statLock);
+}
+
+static void
+statInitKey()
+{
+  pthread_key_create(&statKey, statRelease);
+}
+
+SStatBlock *
+statAcquire()
+{
+  pthread_once(&statOnce, statInitKey);
+
+  SStatBlock *b;
+  pthread_mutex_lock(&statLock);
+  if (!statSpare.empty()) {
+    b = statSpare.back();
+    statSpare.pop_back();
+  } else {
+    b = new SStatBlock();
+    statBlocks.push_back(b);
+  }
+  pthread_mutex_unlock(&statLock);
+
+  pthread_setspecific(statKey, b);
+  statBlock = b;
+  return b;
+}
+
+StatCount
+statClock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (StatCount)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *
+statName(int c)
+{
+  static const char *names[STAT_NUM] = {
+    "ray_primary", "ray_reflect", "ray_refract", "ray_shadow", "ray_photon",
+    "test_sphere", "test_plane", "test_mesh", "test_triangle",
+    "photon_emitted", "photon_rejected", "photon_stored", "photon_dropped",
+    "gather_queries", "gather_visited", "gather_accepted", "gather_precomputed",
+    "shadow_skipped", "shadow_photon",
+    "time_emit", "time_photonmap", "time_irradiance", "time_render",
+  };
+  return (c >= 0 && c < STAT_NUM) ? names[c] : "";
+}
+
+void
+statsCollect(SStatBlock &total)
+{
+  memset(&total, 0, sizeof(total));
+  pthread_mutex_lock(&statLock);
+  for (size_t i = 0; i < statBlocks.size(); i++) {
+    for (int c = 0; c < STAT_NUM; c++) total.count[c] += statBlocks[i]->count[c];
+  }
+  pthread_mutex_unlock(&statLock);
+}
+
+void
+statsReset()
+{
+  pthread_mutex_lock(&statLock);
+  for (size_t i = 0; i < statBlocks.size(); i++) memset(statBlocks[i], 0, sizeof(SStatBlock));
+  pthread_mutex_unlock(&statLock);
+}
+
+static double
+ratio(StatCount a, StatCount b)
+{
+  return b ? (double)a / b : 0.0;
+}
+
+void
+statsPrint(FILE *fp, const SStatBlock &total)
+{
+  const StatCount *n = total.count;
+  for (int c = 0; c < STAT_NUM; c++) {
+    if (c >= STAT_TIME_EMIT) fprintf(fp, "%-18s %14.3f ms\n", statName(c), n[c] * 1.0e-6);
+    else                     fprintf(fp, "%-18s %14llu\n", statName(c), n[c]);
+  }
+
+  StatCount rays = 0, tests = 0;
+  for (int c = STAT_RAY_PRIMARY; c <= STAT_RAY_PHOTON; c++) rays  += n[c];
+  for (int c = STAT_TEST_SPHERE; c <= STAT_TEST_TRIANGLE; c++) tests += n[c];
+  fprintf(fp, "%-18s %14.2f\n", "tests/ray",      ratio(tests, rays));
+  fprintf(fp, "%-18s %14.2f\n", "triangles/mesh", ratio(n[STAT_TEST_TRIANGLE], n[STAT_TEST_MESH]));
+  fprintf(fp, "%-18s %14.3f\n", "stored/emitted", ratio(n[STAT_PHOTON_STORED], n[STAT_PHOTON_EMITTED]));
+  fprintf(fp, "%-18s %14.2f\n", "visited/query",  ratio(n[STAT_GATHER_VISITED], n[STAT_GATHER_QUERIES]));
+  fprintf(fp, "%-18s %14.3f\n", "accepted/visited", ratio(n[STAT_GATHER_ACCEPTED], n[STAT_GATHER_VISITED]));
+}
+
+void
+statsWriteJson(FILE *fp, const SStatBlock &total)
+{
+  fprintf(fp, "{\n");
+  for (int c = 0; c < STAT_NUM; c++) {
+    fprintf(fp, "  \"%s\": %llu%s\n", statName(c), total.count[c], (c + 1 < STAT_NUM) ? "," : "");
+  }
+  fprintf(fp, "}\n");
+}
@@ -0,0 +1,75 @@
+//stats.h
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <cstdio>
+
+//--  counters of the hot paths, thread local, summed by statsCollect()
+//--  build with -DNO_STATS to compile them out
+enum {
+  //--  rays cast, by purpose
+  STAT_RAY_PRIMARY = 0,
+  STAT_RAY_REFLECT,
+  STAT_RAY_REFRACT,
+  STAT_RAY_SHADOW,        //--  light -> point in direct lighting
+  STAT_RAY_PHOTON,        //--  every ray of photon tracing
+  //--  ray-primitive tests
+  STAT_TEST_SPHERE,
+  STAT_TEST_PLANE,
+  STAT_TEST_MESH,         //--  mesh instances entered
+  STAT_TEST_TRIANGLE,
+  //--  emitPhotons()
+  STAT_PHOTON_EMITTED,
+  STAT_PHOTON_REJECTED,   //--  started outside the room or inside a sphere
+  STAT_PHOTON_STORED,
+  STAT_PHOTON_DROPPED,    //--  photonCapacity reached
+  //--  gatherPhotons()
+  STAT_GATHER_QUERIES,
+  STAT_GATHER_VISITED,    //--  photons whose distance was computed
+  STAT_GATHER_ACCEPTED,   //--  photons within the radius
+  STAT_GATHER_PRECOMPUTED,//--  queries answered by a precomputed estimate
+  //--  shadePixel()
+  STAT_SHADOW_SKIPPED,    //--  shadow rays answered by the shadow map
+  //--  emitShadowPhotons() (not in STAT_PHOTON_*)
+  STAT_SHADOW_PHOTON,     //--  photons emitted for the shadow map
+  //--  wall time in ns, counted on the calling thread
+  STAT_TIME_EMIT,
+  STAT_TIME_PHOTONMAP,
+  STAT_TIME_IRRADIANCE,
+  STAT_TIME_RENDER,
+  STAT_NUM
+};
+
+typedef unsigned long long StatCount;
+
+//--  one block per thread, never freed : blocks of finished threads are reused
+typedef struct SStatBlock {
+  StatCount count[STAT_NUM];
+} SStatBlock;
+
+extern __thread SStatBlock *statBlock;
+SStatBlock *statAcquire();
+
+inline void
+statAdd(int c, StatCount n = 1)
+{
+#ifndef NO_STATS
+  SStatBlock *b = statBlock;
+  if (!b) b = statAcquire();
+  b->count[c] += n;
+#endif
+}
+
+//--  monotonic clock in ns, for the STAT_TIME_* counters
+StatCount statClock();
+
+const char *statName(int c);
+//--  sum of every thread's block (call between frames)
+void statsCollect(SStatBlock &total);
+void statsReset();
+//--  human readable, one counter per line with derived ratios
+void statsPrint(FILE *fp, const SStatBlock &total);
+//--  one JSON object, counters by name (times in ns)
+void statsWriteJson(FILE *fp, const SStatBlock &total);
+
+#endif // __STATS_H__
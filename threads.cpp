@@ -0,0 +1,127 @@
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "threads.h"
+
+//--  remaining tasks [head, tail) of a worker
+//--  the owner takes from head, thieves take from tail
+typedef struct SWorkQueue {
+  pthread_mutex_t lock;
+  int head;
+  int tail;
+  char pad[64];       //--  keep queues on separate cache lines
+} SWorkQueue;
+
+typedef struct SWorkers {
+  std::vector<SWorkQueue> queues;
+  TaskFunc fn;
+  void    *arg;
+} SWorkers;
+
+typedef struct SWorkerArg {
+  SWorkers *workers;
+  int       id;
+} SWorkerArg;
+
+int nrThreads = 0;      //--  Worker Threads for Rendering and Emission (0 : all cores)
+
+int
+numCores()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+int
+numThreads()
+{
+  return nrThreads > 0 ? nrThreads : numCores();
+}
+
+//--  take the next own task, -1 if none left
+static int
+popTask(SWorkQueue &q)
+{
+  int task = -1;
+  pthread_mutex_lock(&q.lock);
+  if (q.head < q.tail) task = q.head++;
+  pthread_mutex_unlock(&q.lock);
+  return task;
+}
+
+//--  move the back half of a victim's tasks into the own (empty) queue
+static bool
+stealTasks(SWorkers *w, int id)
+{
+  const int n = w->queues.size();
+  for (int k = 1; k < n; k++) {
+    SWorkQueue &victim = w->queues[(id + k) % n];
+
+    pthread_mutex_lock(&victim.lock);
+    int left = victim.tail - victim.head;
+    int from = victim.tail - (left + 1) / 2;
+    int to   = victim.tail;
+    if (left > 0) victim.tail = from;
+    pthread_mutex_unlock(&victim.lock);
+
+    if (left > 0) {
+      SWorkQueue &own = w->queues[id];
+      pthread_mutex_lock(&own.lock);
+      own.head = from;
+      own.tail = to;
+      pthread_mutex_unlock(&own.lock);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *
+workerMain(void *p)
+{
+  SWorkerArg *wa = (SWorkerArg *)p;
+  SWorkers   *w  = wa->workers;
+
+  do {
+    int task;
+    while ((task = popTask(w->queues[wa->id])) >= 0) {
+      w->fn(task, wa->id, w->arg);
+    }
+  } while (stealTasks(w, wa->id));
+
+  return NULL;
+}
+
+void
+runTasks(int ntasks, int nthreads, TaskFunc fn, void *arg)
+{
+  if (nthreads > ntasks) nthreads = ntasks;
+  if (nthreads <= 1) {
+    for (int i = 0; i < ntasks; i++) fn(i, 0, arg);
+    return;
+  }
+
+  SWorkers w;
+  w.fn  = fn;
+  w.arg = arg;
+  w.queues.resize(nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    pthread_mutex_init(&w.queues[t].lock, NULL);
+    w.queues[t].head = (long long)ntasks *  t      / nthreads;
+    w.queues[t].tail = (long long)ntasks * (t + 1) / nthreads;
+  }
+
+  //--  the calling thread works as worker 0
+  std::vector<pthread_t>  th(nthreads);
+  std::vector<SWorkerArg> wa(nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    wa[t].workers = &w;
+    wa[t].id      = t;
+    if (t > 0) pthread_create(&th[t], NULL, workerMain, &wa[t]);
+  }
+  workerMain(&wa[0]);
+  for (int t = 1; t < nthreads; t++) pthread_join(th[t], NULL);
+
+  for (int t = 0; t < nthreads; t++) pthread_mutex_destroy(&w.queues[t].lock);
+}
@@ -0,0 +1,21 @@
+//threads.h
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+//--  task body : task = index in [0, ntasks), thread = worker id in [0, nthreads)
+typedef void (*TaskFunc)(int task, int thread, void *arg);
+
+extern int nrThreads;   //--  Worker Threads for Rendering and Emission (0 : all cores)
+
+//--  num of online cores
+int  numCores();
+//--  nrThreads resolved to an actual count
+int  numThreads();
+
+//--  run every task once on nthreads workers (pthreads)
+//--  each worker starts with a contiguous block of tasks and steals
+//--  half of a busy worker's remaining block when its own runs out
+//--  nthreads <= 1 : runs the tasks in order on the calling thread
+void runTasks(int ntasks, int nthreads, TaskFunc fn, void *arg);
+
+#endif // __THREADS_H__
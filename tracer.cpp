@@ -0,0 +1,1623 @@
+//------------------------------------------------
+//  Ray Tracing & Photon Mapping
+//  ORIGINAL : Grant Schindler, 2007 (in Java)
+//  http://www.cc.gatech.edu/~phlosoft/photon/
+//
+//  MODIFIED : Kenrato Doba, 2013/02/24
+//------------------------------------------------
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+#include "vector3.h"
+#include "tracer.h"
+#include "threads.h"
+#include "caustic.h"
+#include "shadow.h"
+#include "wavefront.h"
+
+using std::vector;
+using std::max;
+using std::min;
+using namespace WebCore;
+
+// ----- Scene Description -----
+int szImg = 512;            //--  rendering screen size
+int nrTypes = 3;            //--  object tpye = 0:SPHERE, 1:PLANE, 2:TRIANGLE
+int nrObjects = 0;          //--  num of object
+
+// ----- Photon Mapping -----
+int   nrPhotons = 2000;     //--  Number of Photons Emitted
+int   nrBounces = 3;        //--  Number of Times Each Photon Bounces
+bool  russianRoulette = false; //--  Terminate Photons by the Power They Keep
+int   photonSampler = SAMPLER_LEGACY; //--  Random Numbers of the Photons (SAMPLER_*)
+bool  lightPhotons = true;  //--  Enable Photon Lighting?
+float exposure = 100.0;     //--  Number of Photons Integrated at Brightest Pixel
+float photonScale = 1.0;    //--  Emission Multiplier (Photon View)
+int   photonCapacity = 0;   //--  Max Num of Stored Photons (0 : unlimited)
+unsigned int photonSeed = 0;//--  Seed of the Photon Random Streams
+uint64_t     photonFirst = 0;//--  Stream of the First Photon Emitted
+const char  *photonCache = NULL;//--  Directory of the Photon Map Files (NULL : none)
+
+//--  photons of all objects, contiguous per object after emission
+CPhotonStore photonStore;
+//--  kd-tree over each object's photon range, built after emission
+std::vector<CPhotonMap> photonMaps;
+bool       usePhotonMap = true;  //--  false : linear scan in gatherPhotons()
+bool  usePrecomputed = false;    //--  gatherPhotons() : nearest precomputed estimate
+int   precomputeStep = 4;        //--  every nth photon of an object gets an estimate
+int   precomputeMax  = 16384;    //--  max num of estimates : larger steps beyond
+
+void (*photonHook)(const Vector3 &rgb, const Vector3 &p) = NULL;
+
+const Vector3 gOrigin;
+      Vector3 Light(0.0,1.2,3.75);   //Point Light-Source Position
+const float   lightRadius = 0.75;    //Photons Start Below Light, Within This Distance
+const int reflection_limit = 4;
+
+std::vector<CObj> objects;
+std::vector<CMesh*> meshes;
+
+// ----- Acceleration -----
+CBvh  sceneBvh;
+std::vector<int> boundedIds;
+std::vector<int> planeIds;
+bool  useBvh = true;        //--  false : linear loop over all objects
+int   bvhMinObjects = 16;   //--  fewer bounded objects : linear loop
+
+//--  boxes of the bounded objects, 3 floats each
+static std::vector<float> boundsMin, boundsMax;
+
+//----------------------------
+//  Ray-Geometry Intersections
+//----------------------------
+
+real
+rayObject(CObj *ob, const Vector3 &r, const Vector3 &o, int &prim){
+
+  const int id = ob->getIndex();
+  const int tp = scene.type[id];
+  const int sl = scene.slot[id];
+  prim = 0;
+  //--  switch intersection func with object type
+  if      (tp == TYPE_SPHERE) {
+    statAdd(STAT_TEST_SPHERE);
+    return intersectSphere(scene.sphereX[sl], scene.sphereY[sl], scene.sphereZ[sl], scene.sphereR[sl], r, o);
+  } else if (tp == TYPE_PLANE) {
+    statAdd(STAT_TEST_PLANE);
+    return intersectPlane(scene.planeAxis[sl], scene.planeDist[sl], r, o);
+  } else if (tp == TYPE_TRIANGLE) {
+    return ob->calcTriangleIntersection(r, o, prim);
+  }
+
+  return NOT_INTERSECTED;
+}
+
+//----------
+//  Lighting
+//----------
+
+float
+lightDiffuse(const Vector3 &N, const Vector3 &P)
+{
+  //  Diffuse Lighting at Point P with Surface Normal N
+  Vector3 L = Light - P;
+  L.normalize();
+  return dot(N,L);
+}
+
+Vector3
+surfaceNormal(const SIntersectionStat &hit, const Vector3 &P, const Vector3 &Inside){
+  CObj *ob = hit.obj;
+  if (ob->getType() == TYPE_SPHERE)     {
+    return ob->calcSphereNormal(P, Inside);
+  } else if (ob->getType() == TYPE_PLANE) {
+    return ob->calcPlaneNormal(P, Inside);
+  } else if (ob->getType() == TYPE_TRIANGLE) {
+    return ob->calcTriangleNormal(hit.prim, P, Inside);
+  }
+  return Vector3();
+}
+
+float
+lightObject(const SIntersectionStat &hit, const Vector3 &P, float lightAmbient){
+  Vector3 N = surfaceNormal(hit, P, Light);
+  float   i = lightDiffuse(N, P);
+  //--  add in ambient light by constraining min value
+  return min(1.0f, max(i, lightAmbient));
+}
+
+//------------
+//  Raytracing
+//------------
+
+//--  closest hit query of CBvh::intersect()
+typedef struct SClosestHit {
+  const Vector3 &ray;
+  const Vector3 &origin;
+  SIntersectionStat istat;
+  SClosestHit(const Vector3 &r, const Vector3 &o) : ray(r), origin(o) {}
+
+  double tmax() const { return istat.dist; }
+  bool   done() const { return false; }
+  void   test(int prim) { testObject(&objects[boundedIds[prim]]); }
+  void   testObject(CObj *ob) {
+    int    prim;
+    real   dist = rayObject(ob, ray, origin, prim);
+    if (closerHit(istat, dist, ob)) {
+      istat.dist = dist;
+      istat.obj  = ob;
+      istat.prim = prim;
+    }
+  }
+} SClosestHit;
+
+SIntersectionStat
+raytrace(const Vector3 &ray, const Vector3 &origin)
+{
+  if (!useBvh || sceneBvh.empty()) return raytraceLinear(ray, origin);
+
+  SClosestHit q(ray, origin);
+  for (size_t i = 0; i < planeIds.size(); i++) q.testObject(&objects[planeIds[i]]);
+
+  SBvhRay br;
+  double  org[3] = { origin.x(), origin.y(), origin.z() };
+  double  dir[3] = { ray.x(),    ray.y(),    ray.z()    };
+  setBvhRay(br, org, dir);
+  sceneBvh.intersect(br, q);
+  return q.istat;
+}
+
+//--  any-hit query of CBvh::intersect() : the traversal ends at the first
+//--  hit closer than limit, the closest one is never looked for
+typedef struct SAnyHit {
+  const Vector3 &ray;
+  const Vector3 &origin;
+  const CObj    *skip;
+  real  limit;
+  bool  hit;
+  SAnyHit(const Vector3 &r, const Vector3 &o, real tmax, const CObj *s)
+    : ray(r), origin(o), skip(s), limit(tmax), hit(false) {}
+
+  double tmax() const { return limit; }
+  bool   done() const { return hit; }
+  void   test(int prim) { testObject(&objects[boundedIds[prim]]); }
+  void   testObject(CObj *ob) {
+    if (ob == skip) return;
+    if (ob->getType() == TYPE_TRIANGLE) {
+      hit = ob->calcTriangleOcclusion(ray, origin, limit);
+      return;
+    }
+    int  prim;
+    real dist = rayObject(ob, ray, origin, prim);
+    hit = dist > 1.0e-5 && dist < limit;
+  }
+} SAnyHit;
+
+bool
+occluded(const Vector3 &ray, const Vector3 &origin, real tmax, const CObj *skip)
+{
+  SAnyHit q(ray, origin, tmax, skip);
+  if (!useBvh || sceneBvh.empty()) {
+    //--  the loops of raytraceLinear(), left at the first hit
+    const int skipId = skip ? (int)(skip - &objects[0]) : -1;
+    const int nsphere = scene.sphereObj.size();
+    for (int i=0; i<nsphere; i++) {
+      if (scene.sphereObj[i] == skipId) continue;
+      statAdd(STAT_TEST_SPHERE);
+      real dist = intersectSphere(scene.sphereX[i], scene.sphereY[i], scene.sphereZ[i], scene.sphereR[i], ray, origin);
+      if (dist > 1.0e-5 && dist < tmax) return true;
+    }
+    const int nmesh = scene.meshObj.size();
+    for (int i=0; i<nmesh && !q.hit; i++) q.testObject(&objects[scene.meshObj[i]]);
+    const int nplane = scene.planeObj.size();
+    for (int i=0; i<nplane && !q.hit; i++) {
+      if (scene.planeObj[i] == skipId) continue;
+      statAdd(STAT_TEST_PLANE);
+      real dist = intersectPlane(scene.planeAxis[i], scene.planeDist[i], ray, origin);
+      if (dist > 1.0e-5 && dist < tmax) return true;
+    }
+    return q.hit;
+  }
+
+  SBvhRay br;
+  double  org[3] = { origin.x(), origin.y(), origin.z() };
+  double  dir[3] = { ray.x(),    ray.y(),    ray.z()    };
+  setBvhRay(br, org, dir);
+  sceneBvh.intersect(br, q);
+  for (size_t i = 0; i < planeIds.size() && !q.hit; i++) q.testObject(&objects[planeIds[i]]);
+  return q.hit;
+}
+
+//--  keep the closer hit, same rule as the loop over all objects in index order
+static inline void
+updateHit(SIntersectionStat &istat, real dist, int id, int prim)
+{
+  CObj *ob = &objects[id];
+  if (closerHit(istat, dist, ob)) {
+    istat.dist = dist;
+    istat.obj  = ob;
+    istat.prim = prim;
+  }
+}
+
+SIntersectionStat
+raytraceLinear(const Vector3 &ray, const Vector3 &origin)
+{
+  //--  init intersection status
+  SIntersectionStat istat;
+
+  //--  check intersection for each object, one loop per type
+  const int nsphere = scene.sphereObj.size();
+  statAdd(STAT_TEST_SPHERE, nsphere);
+  for (int i=0; i<nsphere; i++) {
+    real dist = intersectSphere(scene.sphereX[i], scene.sphereY[i], scene.sphereZ[i], scene.sphereR[i], ray, origin);
+    if (dist < NOT_INTERSECTED) updateHit(istat, dist, scene.sphereObj[i], 0);
+  }
+  const int nplane = scene.planeObj.size();
+  statAdd(STAT_TEST_PLANE, nplane);
+  for (int i=0; i<nplane; i++) {
+    real dist = intersectPlane(scene.planeAxis[i], scene.planeDist[i], ray, origin);
+    if (dist < NOT_INTERSECTED) updateHit(istat, dist, scene.planeObj[i], 0);
+  }
+  const int nmesh = scene.meshObj.size();
+  for (int i=0; i<nmesh; i++) {
+    int    prim;
+    real   dist = objects[scene.meshObj[i]].calcTriangleIntersection(ray, origin, prim);
+    if (dist < NOT_INTERSECTED) updateHit(istat, dist, scene.meshObj[i], prim);
+  }
+  return istat;
+}
+
+//------------------------
+//  Acceleration Structure
+//------------------------
+
+void
+buildAccel()
+{
+  boundedIds.clear();
+  planeIds.clear();
+  boundsMin.clear();
+  boundsMax.clear();
+
+  float bmin[3], bmax[3];
+  for (int i = 0; i < nrObjects; i++) {
+    if (objects[i].getBounds(bmin, bmax)) {
+      boundedIds.push_back(i);
+      boundsMin.insert(boundsMin.end(), bmin, bmin + 3);
+      boundsMax.insert(boundsMax.end(), bmax, bmax + 3);
+    } else {
+      planeIds.push_back(i);
+    }
+  }
+
+  //--  a handful of objects : the linear loop is faster
+  if ((int)boundedIds.size() < bvhMinObjects) {
+    sceneBvh.clear();
+    return;
+  }
+  sceneBvh.build(boundedIds.size(), &boundsMin[0], &boundsMax[0]);
+}
+
+void
+refitAccel()
+{
+  if (sceneBvh.empty()) return;
+
+  for (size_t p = 0; p < boundedIds.size(); p++) {
+    objects[boundedIds[p]].getBounds(&boundsMin[3 * p], &boundsMax[3 * p]);
+  }
+  sceneBvh.refit(&boundsMin[0], &boundsMax[0]);
+}
+
+Vector3
+primaryRay(float x, float y){
+  //--  generate Ray for each pixel
+  //--  Convert Pixels to Image Plane Coordinates
+  return Vector3(
+      x / szImg - 0.5 ,
+    -(y / szImg - 0.5),
+    1.0
+    //Focal Length = 1.0
+  );
+}
+
+Vector3
+calcPixelColor(float x, float y){
+  Vector3 ray = primaryRay(x, y);
+  statAdd(STAT_RAY_PRIMARY);
+  return shadePixel(ray, raytrace(ray, gOrigin));
+}
+
+bool
+visiblePoint(const Vector3 &primary, const SIntersectionStat &hit,
+    Vector3 &pnt, SIntersectionStat &istat){
+  Vector3 ray = primary;
+  float refractive = 1.0;
+  Vector3 from = gOrigin;
+
+  istat = hit;
+  if (istat.dist >= NOT_INTERSECTED){ return false; }
+
+  //--  get point of intersection
+  pnt = from + ray * istat.dist;
+
+  int ref = 0;
+  //  Mirror Surface on This Specific Object
+  while (istat.obj->getOptics() != OPT_NONE && ref < reflection_limit){
+    statAdd(istat.obj->getOptics() == OPT_REFLECT ? STAT_RAY_REFLECT : STAT_RAY_REFRACT);
+    if(istat.obj->getOptics() == OPT_REFLECT) { ray = reflect(istat, pnt, ray, from); }
+    else                       /*OPT_REFRACT*/{ ray = refract(istat, pnt, ray, from, refractive); }
+    ref++;
+
+    from = pnt;
+    istat = raytrace(ray, from);             //Follow the Reflected Ray
+    if (istat.dist >= NOT_INTERSECTED){ return false; }
+    else {
+      pnt = from + ray * istat.dist;
+    }
+  }
+  return true;
+}
+
+Vector3
+shadePixel(const Vector3 &primary, const SIntersectionStat &hit){
+  Vector3 pnt;
+  SIntersectionStat istat;
+  if (!visiblePoint(primary, hit, pnt, istat)){ return Vector3(0.0,0.0,0.0); }
+  return lightPoint(pnt, istat);
+}
+
+Vector3
+lightPoint(const Vector3 &pnt, const SIntersectionStat &istat){
+  Vector3 rgb(0.0,0.0,0.0);
+
+  if (lightPhotons){
+    //--  Lighting via Photon Mapping
+    rgb = gatherPhotons(pnt, istat);
+  } else {
+    //--  Lighting via Standard Illumination Model (Diffuse + Ambient)
+    //--  Remember Intersected Object
+    SIntersectionStat org_stat = istat;
+
+    //--  If in Shadow, Use Ambient Color of Original Object
+    static const float ambient = 0.1;
+
+    //--  Only Direct or Only Shadow Photons Around? : no shadow ray
+    int vis = SHADOW_MIXED;
+    if (nrShadowPhotons > 0) vis = shadowLookup(pnt);
+    if (vis != SHADOW_MIXED) statAdd(STAT_SHADOW_SKIPPED);
+
+    float intensity = ambient;
+    if (vis == SHADOW_LIT) {
+      intensity = lightObject(org_stat, pnt, ambient);
+    } else if (vis == SHADOW_MIXED) {
+      //--  Ray from Light -> Object Hits Object First? : not in shadow
+      //--  its own hit (where the closest hit would have to be), then
+      //--  anything else before it
+      statAdd(STAT_RAY_SHADOW);
+      Vector3 toPnt = pnt - Light;
+      int  prim;
+      real dist = rayObject(org_stat.obj, toPnt, Light, prim);
+      if (dist > 1.0e-5 && dist < NOT_INTERSECTED && prim == org_stat.prim &&
+          !occluded(toPnt, Light, dist, org_stat.obj)) {
+        intensity = lightObject(org_stat, pnt, ambient);
+      }
+    }
+
+    //--  the colour of the shaded object, lit or not (the first versions
+    //--  took the one the light ray hit first : the occluder's colour in
+    //--  shadow, which would cost a closest hit for every shadowed point)
+    Vector3 energy(intensity, intensity, intensity);
+    rgb = mulColor(energy, org_stat.obj);
+  }
+  return rgb;
+}
+
+Vector3
+reflect(
+    const SIntersectionStat &hit,
+    const Vector3 &point,
+    const Vector3 &ray,
+    const Vector3 &from)
+{
+  Vector3 N = surfaceNormal(hit, point, from);
+
+  Vector3 ans = ray - N * (2 * dot(ray,N));
+  ans.normalize();
+  return ans;
+}
+
+Vector3
+refract(
+    const SIntersectionStat &hit,
+    const Vector3 &point,
+    const Vector3 &ray,
+    const Vector3 &from,
+    float &ref)
+{
+  CObj   *ob = hit.obj;
+  Vector3 N  = surfaceNormal(hit, point, from);
+
+  float n1 = ref;
+  float n2 = ob->getRefractive();
+  float s  = dot(ray, N);
+
+  if(ob->getType() == TYPE_SPHERE && s > 0) {
+    //--  from inside to outside : swap n1 and n2
+    float tmp = n1;
+    n1 = n2;
+    n2 = tmp;
+  }
+
+  float n  = n1 / n2;
+
+  Vector3 ans = n * (ray - s * N) - N * sqrt(1 - n * n * (1 - s * s) );
+  ans.normalize();
+
+  ref = n2;
+  return ans;
+}
+
+//----------------
+//  Photon Mapping
+//----------------
+
+//--  Photon Integration Area (Squared for Efficiency)
+const float sqRadius = 0.7;
+
+//--  Single Photon Diffuse Lighting, Weighted by Photon-Point Distance
+inline void
+addPhotonEnergy(Vector3 &energy, const Vector3 &N,
+    const Vector3 &dir, const Vector3 &power, double cur_dist)
+{
+  float weight = max((real)0.0, -dot(N, dir) );
+  weight     *= (1.0 - cur_dist) / exposure;
+  Vector3 tmp = power * weight;
+  energy      = energy + tmp;
+}
+
+//--  accumulates the photons found by CPhotonMap::locate()
+typedef struct SGatherEnergy {
+  Vector3 N;
+  Vector3 energy;
+  void operator ()(int i, double dist) {
+    addPhotonEnergy(energy, N,
+        Vector3(&photonStore.dir[3 * i]), Vector3(&photonStore.power[3 * i]), dist);
+  }
+} SGatherEnergy;
+
+//--  precomputed irradiance (Christensen) : estimates at every
+//--  precomputeStep-th photon, pos : photon position, dir : surface normal,
+//--  power : gatherPhotons() there; one kd-tree per object
+static CPhotonStore irradStore;
+static std::vector<CPhotonMap> irradMaps;
+
+//--  estimates made on the other side of a thin object or around an edge
+//--  do not apply : the normals must agree
+static const float irradianceCos = 0.9;
+
+typedef struct SSameNormal {
+  Vector3 N;
+  bool operator ()(int i) const {
+    const float *n = &irradStore.dir[3 * i];
+    return N[0] * n[0] + N[1] * n[1] + N[2] * n[2] > irradianceCos;
+  }
+} SSameNormal;
+
+Vector3
+gatherPhotons(const Vector3 &p, const SIntersectionStat &hit)
+{
+  if (!usePhotonMap) return gatherPhotonsLinear(p, hit);
+  statAdd(STAT_GATHER_QUERIES);
+
+  SGatherEnergy gather;
+  gather.N = surfaceNormal(hit, p, gOrigin);
+  const int id = hit.obj->getIndex();
+
+  //--  sharp caustics from their own map
+  Vector3 caustic;
+  if (nrCaustics > 0) caustic = gatherCaustics(p, gather.N, id);
+
+  //--  estimate of the nearest photon with the same normal, if any
+  if (usePrecomputed && (int)irradMaps.size() == nrObjects) {
+    SSameNormal same;
+    same.N = gather.N;
+    int i = irradMaps[id].closest(p, sqRadius, same);
+    if (i >= 0) {
+      statAdd(STAT_GATHER_PRECOMPUTED);
+      return Vector3(&irradStore.power[3 * i]) + caustic;
+    }
+  }
+
+  //--  only photons which hit current object
+  photonMaps[id].locate(p, sqRadius, gather);
+  return gather.energy + caustic;
+}
+
+typedef struct SIrradianceJob {
+  std::vector<int>   photon;    //--  photons that get an estimate
+  std::vector<float> normal;    //--  3 floats per estimate
+  std::vector<float> estimate;
+} SIrradianceJob;
+
+static const int irradiance_chunk = 256;
+
+static void
+irradianceChunk(int chunk, int, void *arg)
+{
+  SIrradianceJob *job = (SIrradianceJob *)arg;
+  const int end = std::min((int)job->photon.size(), (chunk + 1) * irradiance_chunk);
+  for (int k = chunk * irradiance_chunk; k < end; k++) {
+    const int i = job->photon[k];
+    SIntersectionStat hit;
+    hit.obj = &objects[photonStore.obj[i]];
+
+    //--  the full gather at the photon, with the normal of its surface
+    Vector3 p(&photonStore.pos[3 * i]);
+    SGatherEnergy gather;
+    gather.N = surfaceNormal(hit, p, gOrigin);
+    statAdd(STAT_GATHER_QUERIES);
+    photonMaps[hit.obj->getIndex()].locate(p, sqRadius, gather);
+
+    for (int c = 0; c < 3; c++) {
+      job->normal  [3 * k + c] = gather.N[c];
+      job->estimate[3 * k + c] = gather.energy[c];
+    }
+  }
+}
+
+void
+precomputeIrradiance()
+{
+  StatCount t0 = statClock();
+  irradStore.clear();
+  irradMaps.clear();
+  if (!usePrecomputed) return;
+
+  //--  not on meshes : a photon does not know its triangle (the normal)
+  SIrradianceJob job;
+  int candidates = 0;
+  for (int id = 0; id < nrObjects && id < photonStore.numRanges(); id++) {
+    if (objects[id].getType() == TYPE_TRIANGLE) continue;
+    candidates += photonStore.rangeEnd(id) - photonStore.rangeBegin(id);
+  }
+  //--  each estimate costs a full gather : many photons, sparser estimates
+  int step = std::max(1, precomputeStep);
+  if (precomputeMax > 0) step = std::max(step, (candidates + precomputeMax - 1) / precomputeMax);
+  for (int id = 0; id < nrObjects && id < photonStore.numRanges(); id++) {
+    if (objects[id].getType() == TYPE_TRIANGLE) continue;
+    for (int i = photonStore.rangeBegin(id); i < photonStore.rangeEnd(id); i += step) {
+      job.photon.push_back(i);
+    }
+  }
+  const int num = job.photon.size();
+  job.normal  .resize(3 * num);
+  job.estimate.resize(3 * num);
+  const int nchunks = (num + irradiance_chunk - 1) / irradiance_chunk;
+  runTasks(nchunks, std::max(1, std::min(numThreads(), nchunks)), irradianceChunk, &job);
+
+  irradStore.reserve(num);
+  for (int k = 0; k < num; k++) {
+    const int i = job.photon[k];
+    irradStore.store(photonStore.obj[i], Vector3(&photonStore.pos[3 * i]),
+        Vector3(&job.normal[3 * k]), Vector3(&job.estimate[3 * k]));
+  }
+  irradStore.sortByObject(nrObjects);
+  irradMaps.resize(nrObjects);
+  for (int id = 0; id < nrObjects; id++) {
+    irradMaps[id].build(&irradStore, irradStore.rangeBegin(id), irradStore.rangeEnd(id), numThreads());
+  }
+  statAdd(STAT_TIME_IRRADIANCE, statClock() - t0);
+}
+
+Vector3
+gatherPhotonsLinear(const Vector3 &p, const SIntersectionStat &hit)
+{
+  Vector3 energy;
+  int id = hit.obj->getIndex();
+  //printf("%d\n", id);
+  Vector3 N = surfaceNormal(hit, p, gOrigin);
+
+  const int begin = photonStore.rangeBegin(id);
+  const int end   = photonStore.rangeEnd(id);
+  int accepted = 0;
+  for (int i = begin; i < end; i++) {
+    //--  Photons Which Hit Current Object
+    double cur_dist = photonDistance(p, &photonStore.pos[3 * i]);
+
+    //--  Is Photon Close to Point?
+    if (cur_dist < sqRadius) {
+      accepted++;
+      addPhotonEnergy(energy, N,
+          Vector3(&photonStore.dir[3 * i]), Vector3(&photonStore.power[3 * i]), cur_dist);
+    }
+  }
+  statAdd(STAT_GATHER_QUERIES);
+  statAdd(STAT_GATHER_VISITED,  end - begin);
+  statAdd(STAT_GATHER_ACCEPTED, accepted);
+  if (nrCaustics > 0) energy += gatherCaustics(p, N, id);
+  return energy;
+}
+
+Vector3
+randDir(CSampler &smp, double s)
+{
+  //--  generate vector with random derection
+  double tmp[3];
+  if (smp.type() != SAMPLER_LEGACY) {
+    sampleSphere(smp.next1D(), smp.next1D(), tmp);
+    return Vector3(tmp) * s;
+  }
+  for(int i=0; i<3; i++) {
+    tmp[i] = smp.next1D() * 2 * s - s;
+  }
+  Vector3 ans(tmp);
+  ans.normalize();
+  return ans;
+}
+
+//--  containment query of CBvh::contain()
+typedef struct SInsideSphere {
+  const Vector3 &p;
+  bool inside;
+  SInsideSphere(const Vector3 &pnt) : p(pnt), inside(false) {}
+
+  void test(int prim) {
+    const int id = boundedIds[prim];
+    if (scene.type[id] != TYPE_SPHERE) return;
+    const int sl = scene.slot[id];
+    Vector3 center(scene.sphereX[sl], scene.sphereY[sl], scene.sphereZ[sl]);
+    if (distance(p, center) < scene.sphereR[sl]) inside = true;
+  }
+} SInsideSphere;
+
+//--  ray segment of a photon path (start, end), for refreshPhotons()
+//--  rays that leave the scene end NOT_INTERSECTED away
+static inline void
+recordSegment(std::vector<float> *segs, const Vector3 &from, const Vector3 &ray, real dist)
+{
+  if (!segs) return;
+  Vector3 to = from + ray * dist;
+  for (int k = 0; k < 3; k++) segs->push_back(from[k]);
+  for (int k = 0; k < 3; k++) segs->push_back(to[k]);
+}
+
+bool
+startPhoton(CSampler &smp, Vector3 &from, Vector3 &ray)
+{
+  bool valid = true;
+
+  //--  initialize photon properties (direction, location)
+  ray  = randDir(smp, 1.0);
+  from = Light;
+
+  //--  randomize photon locations : on the lower half of the sphere around Light
+  if (smp.type() != SAMPLER_LEGACY) {
+    double d[3];
+    sampleHemisphere(smp.next1D(), smp.next1D(), 1, -1.0, d);
+    from = Vector3(d) * lightRadius + Light;
+  } else {
+    //--  one direction from the cube, folded below Light (the cube is
+    //--  symmetric in y : same distribution as drawing until y < 0)
+    Vector3 d = randDir(smp, 1.0);
+    if (d.y() > 0.0) d = Vector3(d.x(), -d.y(), d.z());
+    from = d * lightRadius + Light;
+  }
+
+  //--  photons outside of the room : invalid
+  if (fabs(from.x()) > 1.5 || fabs(from.y()) > 1.2 ) {
+    valid = false;
+  }
+
+  //--  photons inside any objects : invalid
+  if (useBvh && !sceneBvh.empty()) {
+    SInsideSphere q(from);
+    double p[3] = { from.x(), from.y(), from.z() };
+    sceneBvh.contain(p, q);
+    if (q.inside) valid = false;
+  } else {
+    const int nsphere = scene.sphereObj.size();
+    for(int dx = 0; dx<nsphere; dx++) {
+      Vector3 center(scene.sphereX[dx], scene.sphereY[dx], scene.sphereZ[dx]);
+      if(distance(from, center) < scene.sphereR[dx]) {
+        valid = false;
+      }
+    }
+  }
+  return valid;
+}
+
+//--  power of a photon after the diffuse bounce off ob (false : terminated)
+//--  without russianRoulette the power falls off by 1 / sqrt(bounces); with
+//--  it the photon goes on with probability max(albedo) and the survivors
+//--  carry the power of the terminated ones (rgb / max(albedo) per channel
+//--  of the albedo) : same power per photon, on average the same map
+static bool
+bouncePower(Vector3 &rgb, CObj *ob, int bounces, CSampler &smp, float &weight)
+{
+  Vector3 col = mulColor(rgb, ob);
+  if (!russianRoulette) {
+    rgb = col * (1.0 / sqrt((double)bounces));
+    return true;
+  }
+  double before = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+  double after  = std::max(col[0], std::max(col[1], col[2]));
+  double keep   = before > 0.0 ? after / before : 0.0;
+  if (keep < 1.0) {
+    if (smp.next1D() >= keep) return false;
+    col     = col * (1.0 / keep);
+    weight /= keep;
+  }
+  rgb = col;
+  return true;
+}
+
+void
+emitPhoton(CSampler &smp, CPhotonStore &st, std::vector<float> *segs)
+{
+  Vector3 rgb, ray, from;
+  Vector3 white(1.0, 1.0, 1.0);
+
+  rgb = white;
+  int bounces = startPhoton(smp, from, ray) ? 1 : nrBounces + 1;
+
+  statAdd(STAT_PHOTON_EMITTED);
+  if (bounces > nrBounces) statAdd(STAT_PHOTON_REJECTED);
+
+  //--  Russian roulette : 1 / probability of the path so far
+  float weight = 1.0f;
+
+  //--  calc intersection (1st time)
+  float refractive = 1.0;
+  statAdd(STAT_RAY_PHOTON);
+  SIntersectionStat istat = raytrace(ray, from);
+  recordSegment(segs, from, ray, istat.dist);
+
+  //--  calc bounced photon's intercection (2nd, 3rd, ...)
+  while (istat.dist < NOT_INTERSECTED && bounces <= nrBounces){
+    Vector3 pnt = from + ray * istat.dist;
+
+    //--  reflect or refract
+    int ref = 0;
+    while (istat.obj->getOptics() != OPT_NONE && ref < reflection_limit){
+      if(istat.obj->getOptics() == OPT_REFLECT) { ray = reflect(istat, pnt, ray, from); }
+      else                       /*OPT_REFRACT*/{ ray = refract(istat, pnt, ray, from, refractive); }
+      ref++;
+
+      from = pnt;
+      statAdd(STAT_RAY_PHOTON);
+      istat = raytrace(ray, from);             //Follow the Reflected Ray
+      recordSegment(segs, from, ray, istat.dist);
+      if (istat.dist >= NOT_INTERSECTED){ break; }
+      else {
+        pnt = from + ray * istat.dist;
+      }
+    }
+
+    if(istat.dist >= NOT_INTERSECTED) { continue; }
+
+    if (!bouncePower(rgb, istat.obj, bounces, smp, weight)) break;
+
+    //--  light -> mirrors and glass -> here : a caustic, in the caustic map
+    if (bounces > 1 || ref == 0 || nrCaustics <= 0) storePhoton(st, istat.obj, pnt, ray, rgb);
+    shadowPhoton(st, ray, pnt, segs, weight);
+
+    ray = reflect(istat, pnt, ray, from);
+
+    statAdd(STAT_RAY_PHOTON);
+    istat = raytrace(ray, pnt);
+    recordSegment(segs, pnt, ray, istat.dist);
+    if(istat.dist >= NOT_INTERSECTED){ break; }
+
+    from = pnt;
+    bounces++;
+  }
+}
+
+//--  photons are emitted in fixed size chunks of consecutive photon indices
+//--  each worker stores into its own buffer, photon ranges are merged by index
+static const int emit_chunk = 256;
+
+//--  what the path ray of a photon in emitChunkWave() was traced for
+enum {
+  WAVE_FIRST = 0,       //--  from the light
+  WAVE_SPECULAR,        //--  reflected or refracted by a mirror or glass
+  WAVE_BOUNCE           //--  reflected by a diffuse surface
+};
+
+//--  emitPhoton() of one photon, between the generations
+typedef struct SWavePhoton {
+  CSampler smp;
+  Vector3  rgb, ray, from, pnt;
+  SIntersectionStat istat;
+  int      bounces;
+  int      ref;
+  int      stage;
+  float    weight;
+  float    refractive;
+  SWavePhoton(const CSampler &s) : smp(s) {}
+} SWavePhoton;
+
+//--  buffers of one worker for emitChunkWave(), reused by its chunks
+//--  the stores and segments of a chunk go in generation order, with their
+//--  photon, and are put back in photon order at the end of the chunk
+typedef struct SWaveEmit {
+  CWaveQueue cur, next;                    //--  item : 2 * photon (+ 1 : shadow ray)
+  std::vector<SWavePhoton> photons;
+  CPhotonStore       store;
+  std::vector<int>   storeOwner;
+  std::vector<float> segs;
+  std::vector<int>   segOwner;
+  std::vector<int>   bounds, perm, cursor;
+  SWaveEmit() : cur(2 * emit_chunk), next(2 * emit_chunk) { photons.reserve(emit_chunk); }
+} SWaveEmit;
+
+typedef struct SEmitJob {
+  PhotonFunc emit;
+  int        sampler;                      //--  SAMPLER_* of the streams
+  uint64_t   family;                       //--  photon i : stream family + photonFirst + i
+  const int *ids;                          //--  photon indices, NULL : 0 .. num-1
+  int num;
+  bool track;                              //--  record path segments
+  std::vector<long long> tally;            //--  per thread : sum of what emit returned
+  std::vector<CPhotonStore*> stores;       //--  per thread
+  std::vector<std::vector<float> > segs;   //--  per thread
+  std::vector<int> itemThread;             //--  per photon : buffers and ranges in them
+  std::vector<int> itemBegin;
+  std::vector<int> itemEnd;
+  std::vector<int> segBegin;
+  std::vector<int> segEnd;
+  std::vector<SWaveEmit*> waves;           //--  per thread (useWavefront)
+} SEmitJob;
+
+static void
+emitChunk(int chunk, int thread, void *arg)
+{
+  SEmitJob     *job  = (SEmitJob *)arg;
+  CPhotonStore &st   = *job->stores[thread];
+  std::vector<float> *segs = job->track ? &job->segs[thread] : NULL;
+
+  int end = std::min(job->num, (chunk + 1) * emit_chunk);
+  for (int k = chunk * emit_chunk; k < end; k++) {
+    int i = job->ids ? job->ids[k] : k;
+    job->itemThread[k] = thread;
+    job->itemBegin [k] = st.size();
+    job->segBegin  [k] = segs ? segs->size() / 6 : 0;
+    //--  random sequence depends only on seed and photon index
+    CSampler smp(job->sampler, photonSeed, job->family + photonFirst + i);
+    job->tally[thread] += job->emit(smp, st, segs);
+    job->itemEnd   [k] = st.size();
+    job->segEnd    [k] = segs ? segs->size() / 6 : 0;
+  }
+}
+
+//--  photon j of the chunk reached a surface (istat, pnt) : queued on
+//--  through mirrors and glass, or stored with its shadow ray and the
+//--  diffuse bounce queued, as in emitPhoton()
+static void
+advancePhoton(SWaveEmit &we, int j, CWaveQueue &next)
+{
+  SWavePhoton &p = we.photons[j];
+  const int optics = p.istat.obj->getOptics();
+  if (optics != OPT_NONE && p.ref < reflection_limit) {
+    if (optics == OPT_REFLECT) p.ray = reflect(p.istat, p.pnt, p.ray, p.from);
+    else                       p.ray = refract(p.istat, p.pnt, p.ray, p.from, p.refractive);
+    p.ref++;
+    p.from  = p.pnt;
+    p.stage = WAVE_SPECULAR;
+    statAdd(STAT_RAY_PHOTON);
+    next.push(p.ray, p.from, 2 * j);
+    return;
+  }
+
+  if (!bouncePower(p.rgb, p.istat.obj, p.bounces, p.smp, p.weight)) return;
+
+  if (p.bounces > 1 || p.ref == 0 || nrCaustics <= 0) {
+    storePhoton(we.store, p.istat.obj, p.pnt, p.ray, p.rgb);
+    we.storeOwner.push_back(j);
+  }
+  //--  shadow ray (shadowPhoton()) before the bounce : it comes first in
+  //--  the next generation, p.weight is still that of this hit there
+  statAdd(STAT_RAY_PHOTON);
+  next.push(p.ray, p.pnt + p.ray * 1.0e-5, 2 * j + 1);
+
+  p.ray   = reflect(p.istat, p.pnt, p.ray, p.from);
+  p.stage = WAVE_BOUNCE;
+  statAdd(STAT_RAY_PHOTON);
+  next.push(p.ray, p.pnt, 2 * j);
+}
+
+//--  stable counting sort of the entries by owner (num owners) : perm,
+//--  entries of owner j at [bounds[j], bounds[j+1])
+static void
+groupByOwner(const std::vector<int> &owner, int num,
+    std::vector<int> &bounds, std::vector<int> &perm, std::vector<int> &cursor)
+{
+  bounds.assign(num + 1, 0);
+  for (size_t e = 0; e < owner.size(); e++) bounds[owner[e] + 1]++;
+  for (int j = 0; j < num; j++) bounds[j + 1] += bounds[j];
+  cursor.assign(bounds.begin(), bounds.end() - 1);
+  perm.resize(owner.size());
+  for (size_t e = 0; e < owner.size(); e++) perm[cursor[owner[e]]++] = e;
+}
+
+//--  emitChunk() a generation at a time : the path rays of all photons of
+//--  the chunk (and the shadow rays of the last hits) in one CWaveQueue
+//--  the rays are processed in push order, the random numbers of a photon
+//--  are drawn in the order of emitPhoton() : the same photons
+static void
+emitChunkWave(int chunk, int thread, void *arg)
+{
+  SEmitJob  *job = (SEmitJob *)arg;
+  SWaveEmit &we  = *job->waves[thread];
+  const int first = chunk * emit_chunk;
+  const int np    = std::min(job->num, first + emit_chunk) - first;
+
+  we.photons.clear();
+  we.store.clear();
+  we.storeOwner.clear();
+  we.segs.clear();
+  we.segOwner.clear();
+  CWaveQueue *cur = &we.cur, *next = &we.next;
+  cur->clear();
+  for (int j = 0; j < np; j++) {
+    int i = job->ids ? job->ids[first + j] : first + j;
+    SWavePhoton p(CSampler(job->sampler, photonSeed, job->family + photonFirst + i));
+    p.rgb        = Vector3(1.0, 1.0, 1.0);
+    p.bounces    = startPhoton(p.smp, p.from, p.ray) ? 1 : nrBounces + 1;
+    p.ref        = 0;
+    p.stage      = WAVE_FIRST;
+    p.weight     = 1.0f;
+    p.refractive = 1.0;
+    statAdd(STAT_PHOTON_EMITTED);
+    if (p.bounces > nrBounces) statAdd(STAT_PHOTON_REJECTED);
+    we.photons.push_back(p);
+    statAdd(STAT_RAY_PHOTON);
+    cur->push(p.ray, p.from, 2 * j);
+  }
+
+  while (cur->size() > 0) {
+    cur->trace();
+    next->clear();
+    for (int q = 0; q < cur->size(); q++) {
+      const int j = cur->item(q) >> 1;
+      SWavePhoton &p = we.photons[j];
+      const SIntersectionStat &hit = cur->hit(q);
+      if (job->track) {
+        recordSegment(&we.segs, cur->origin(q), cur->ray(q), hit.dist);
+        we.segOwner.push_back(j);
+      }
+      if (hit.dist >= NOT_INTERSECTED) continue;
+
+      if (cur->item(q) & 1) {
+        Vector3 shadow (-0.25,-0.25,-0.25);
+        shadow = shadow * p.weight;
+        storePhoton(we.store, hit.obj, cur->origin(q) + cur->ray(q) * hit.dist, cur->ray(q), shadow);
+        we.storeOwner.push_back(j);
+        continue;
+      }
+
+      p.istat = hit;
+      if (p.stage == WAVE_BOUNCE) {
+        p.from = p.pnt;
+        p.bounces++;
+      }
+      if (p.stage != WAVE_SPECULAR) {
+        if (p.bounces > nrBounces) continue;
+        p.ref = 0;
+      }
+      p.pnt = p.from + p.ray * hit.dist;
+      advancePhoton(we, j, *next);
+    }
+    std::swap(cur, next);
+  }
+
+  //--  back in photon order, into the buffers of the thread
+  CPhotonStore &st = *job->stores[thread];
+  std::vector<float> *segs = job->track ? &job->segs[thread] : NULL;
+  groupByOwner(we.storeOwner, np, we.bounds, we.perm, we.cursor);
+  for (int j = 0; j < np; j++) {
+    const int k = first + j;
+    job->itemThread[k] = thread;
+    job->itemBegin [k] = st.size();
+    for (int e = we.bounds[j]; e < we.bounds[j + 1]; e++) st.append(we.store, we.perm[e], we.perm[e] + 1);
+    job->itemEnd   [k] = st.size();
+  }
+  groupByOwner(we.segOwner, np, we.bounds, we.perm, we.cursor);
+  for (int j = 0; j < np; j++) {
+    const int k = first + j;
+    job->segBegin  [k] = segs ? segs->size() / 6 : 0;
+    for (int e = we.bounds[j]; segs && e < we.bounds[j + 1]; e++) {
+      const float *sg = &we.segs[6 * we.perm[e]];
+      segs->insert(segs->end(), sg, sg + 6);
+    }
+    job->segEnd    [k] = segs ? segs->size() / 6 : 0;
+  }
+}
+
+//--  the photons of emitPhotons() and refreshPhotons()
+static int
+tracePhoton(CSampler &smp, CPhotonStore &st, std::vector<float> *segs)
+{
+  emitPhoton(smp, st, segs);
+  return 0;
+}
+
+static void
+runEmitJob(SEmitJob &job, PhotonFunc fn, int sampler, uint64_t family,
+    const int *ids, int num, bool track)
+{
+  const int nchunks = (num + emit_chunk - 1) / emit_chunk;
+  const int threads = std::max(1, std::min(numThreads(), nchunks));
+
+  job.emit    = fn;
+  job.sampler = sampler;
+  job.family  = family;
+  job.ids     = ids;
+  job.num     = num;
+  job.track   = track;
+  job.tally.assign(threads, 0);
+  job.stores.resize(threads);
+  for (int t = 0; t < threads; t++) job.stores[t] = new CPhotonStore();
+  job.segs.resize(threads);
+  job.itemThread.resize(num);
+  job.itemBegin .resize(num);
+  job.itemEnd   .resize(num);
+  job.segBegin  .resize(num);
+  job.segEnd    .resize(num);
+
+  //--  emitChunkWave() follows emitPhoton() only
+  if (!useWavefront || fn != tracePhoton) {
+    runTasks(nchunks, threads, emitChunk, &job);
+    return;
+  }
+  for (int t = 0; t < threads; t++) job.waves.push_back(new SWaveEmit());
+  runTasks(nchunks, threads, emitChunkWave, &job);
+  for (int t = 0; t < threads; t++) delete job.waves[t];
+  job.waves.clear();
+}
+
+static void
+freeEmitJob(SEmitJob &job)
+{
+  for (size_t t = 0; t < job.stores.size(); t++) delete job.stores[t];
+  job.stores.clear();
+}
+
+//--  the photons of the job into dst in photon index order : same photons
+//--  for any thread count; dst holds at most its capacity, the rest is
+//--  dropped in photon order (the thread buffers are not capped : with
+//--  stolen chunks a buffer is not in photon order, a cap there would keep
+//--  other photons than the truncation); returns the photons of the job
+static int
+mergeEmitJob(const SEmitJob &job, CPhotonStore &dst)
+{
+  const int capacity = dst.getCapacity();
+  int total = 0;
+  for (int k = 0; k < job.num; k++) total += job.itemEnd[k] - job.itemBegin[k];
+  dst.reserve(dst.size() + (capacity > 0 ? std::min(total, capacity) : total));
+  int merged = 0;
+  for (int k = 0; k < job.num; k++) {
+    if (capacity > 0 && dst.size() >= capacity) break;
+    dst.append(*job.stores[job.itemThread[k]], job.itemBegin[k], job.itemEnd[k]);
+    merged += job.itemEnd[k] - job.itemBegin[k];
+  }
+  dst.addDropped(total - merged);
+  return total;
+}
+
+long long
+emitPhotonsInto(CPhotonStore &dst, PhotonFunc fn, int sampler, uint64_t family, int num)
+{
+  SEmitJob job;
+  runEmitJob(job, fn, sampler, family, NULL, num, false);
+  mergeEmitJob(job, dst);
+  freeEmitJob(job);
+  long long sum = 0;
+  for (size_t t = 0; t < job.tally.size(); t++) sum += job.tally[t];
+  return sum;
+}
+
+//--  paths of the last emission, kept while trackPhotonPaths is on
+//--  the stored photons are in photon index order (before sortByObject())
+typedef struct SPhotonPaths {
+  bool          valid;
+  CPhotonStore *store;
+  std::vector<int>   first;      //--  photon i : store range [first[i], first[i+1])
+  std::vector<float> segs;       //--  6 floats per ray segment : start, end
+  std::vector<int>   segFirst;   //--  photon i : segments [segFirst[i], segFirst[i+1])
+
+  //--  what the paths were traced with
+  int           num;
+  unsigned int  seed;
+  uint64_t      stream;
+  int           bounces;
+  int           objects;
+  bool          caustics;     //--  nrCaustics > 0
+  bool          roulette;
+  int           sampler;
+  Vector3       light;
+
+  //--  boxes of the objects moved since, 6 floats each
+  std::vector<float> dirty;
+} SPhotonPaths;
+
+bool trackPhotonPaths = false;
+static SPhotonPaths photonPaths;
+
+//--  photon i of the job (or of the old paths if the job did not retrace it)
+//--  appended to the new paths
+static void
+appendPath(SPhotonPaths &np, const SEmitJob &job, int k)
+{
+  const CPhotonStore &st = *job.stores[job.itemThread[k]];
+  np.store->append(st, job.itemBegin[k], job.itemEnd[k]);
+  const float *s = &job.segs[job.itemThread[k]][0];
+  np.segs.insert(np.segs.end(), s + 6 * job.segBegin[k], s + 6 * job.segEnd[k]);
+  np.first   .push_back(np.store->size());
+  np.segFirst.push_back(np.segs.size() / 6);
+}
+
+static void
+appendPath(SPhotonPaths &np, const SPhotonPaths &op, int i)
+{
+  np.store->append(*op.store, op.first[i], op.first[i + 1]);
+  np.segs.insert(np.segs.end(),
+      op.segs.begin() + 6 * op.segFirst[i], op.segs.begin() + 6 * op.segFirst[i + 1]);
+  np.first   .push_back(np.store->size());
+  np.segFirst.push_back(np.segs.size() / 6);
+}
+
+//--  new paths of num photons : retraced ones from the job (ids ascending),
+//--  the others from the current paths
+static void
+updatePaths(const SEmitJob &job, const int *ids, int nids, int num)
+{
+  SPhotonPaths np;
+  np.store = new CPhotonStore();
+  np.first   .reserve(num + 1);
+  np.segFirst.reserve(num + 1);
+  np.first   .push_back(0);
+  np.segFirst.push_back(0);
+
+  int k = 0;
+  for (int i = 0; i < num; i++) {
+    if (k < nids && (ids ? ids[k] : k) == i) appendPath(np, job, k++);
+    else                                     appendPath(np, photonPaths, i);
+  }
+
+  delete photonPaths.store;
+  photonPaths.store = np.store;
+  photonPaths.first   .swap(np.first);
+  photonPaths.segs    .swap(np.segs);
+  photonPaths.segFirst.swap(np.segFirst);
+
+  photonPaths.valid    = true;
+  photonPaths.num      = num;
+  photonPaths.seed     = photonSeed;
+  photonPaths.stream   = photonFirst;
+  photonPaths.bounces  = nrBounces;
+  photonPaths.objects  = nrObjects;
+  photonPaths.caustics = nrCaustics > 0;
+  photonPaths.roulette = russianRoulette;
+  photonPaths.sampler  = photonSampler;
+  photonPaths.light    = Light;
+  photonPaths.dirty.clear();
+}
+
+//--  total photons merged into photonStore from before on : stored up
+//--  to photonCapacity, the rest dropped
+static void
+countMerged(int before, int total)
+{
+  const int stored = photonStore.size() - before;
+  statAdd(STAT_PHOTON_STORED,  stored);
+  statAdd(STAT_PHOTON_DROPPED, total - stored);
+}
+
+//--  photons of the paths -> photonStore
+static void
+storePaths()
+{
+  const int total = photonPaths.store->size();
+  photonStore.clear();
+  photonStore.setCapacity(photonCapacity);
+  photonStore.reserve(photonCapacity > 0 ? std::min(total, photonCapacity) : total);
+  photonStore.append(*photonPaths.store, 0, total);
+  countMerged(0, total);
+}
+
+//--  photon visualization (shadow photons carry negative power)
+static void
+finishEmission(StatCount t0)
+{
+  if (photonHook) {
+    for (int i = 0; i < photonStore.size(); i++) {
+      const float *e = &photonStore.power[3 * i];
+      if (e[0] >= 0.0f) photonHook(Vector3(e), Vector3(&photonStore.pos[3 * i]));
+    }
+  }
+  statAdd(STAT_TIME_EMIT, statClock() - t0);
+}
+
+//--  key of the photons in photonStore (preparePhotons())
+static bool photonKeyValid = false;
+static unsigned long long photonKeyStored;
+
+void emitPhotons(){
+  StatCount t0 = statClock();
+  photonKeyValid = false;
+
+  //--  init photon num
+  photonStore.clear();
+  photonStore.setCapacity(photonCapacity);
+
+  //--  control photon num with rendering option
+  const int num_photon = nrPhotons * photonScale;
+
+  SEmitJob job;
+  runEmitJob(job, tracePhoton, photonSampler, 0, NULL, num_photon, trackPhotonPaths);
+
+  if (trackPhotonPaths) {
+    updatePaths(job, NULL, num_photon, num_photon);
+    freeEmitJob(job);
+    storePaths();
+  } else {
+    photonPaths.valid = false;
+    const int before = photonStore.size();
+    countMerged(before, mergeEmitJob(job, photonStore));
+    freeEmitJob(job);
+  }
+
+  finishEmission(t0);
+  buildPhotonMaps();
+  emitCaustics();
+}
+
+//--  like buildPhotonMaps(), the ranges of the unchanged objects are copied
+//--  from old (the store of the last build : same photons, already balanced)
+static void
+updatePhotonMaps(CPhotonStore &old, const std::vector<char> &changed)
+{
+  StatCount t0 = statClock();
+  photonStore.sortByObject(nrObjects);
+  photonMaps.resize(nrObjects);
+  for (int id = 0; id < nrObjects; id++) {
+    const int first = photonStore.rangeBegin(id);
+    const int last  = photonStore.rangeEnd(id);
+    if (!changed[id] && last - first == old.rangeEnd(id) - old.rangeBegin(id)) {
+      photonStore.copyRange(first, old, old.rangeBegin(id), last - first);
+      photonMaps[id].attach(&photonStore, first, last);
+    } else {
+      photonMaps[id].build(&photonStore, first, last, numThreads());
+    }
+  }
+  statAdd(STAT_TIME_PHOTONMAP, statClock() - t0);
+  precomputeIrradiance();
+}
+
+unsigned long long
+photonKey()
+{
+  //--  everything emitPhotons() depends on
+  unsigned long long h = scene.hash();
+  const int opts[] = {
+    (int)(nrPhotons * photonScale), nrBounces, photonCapacity,
+    (int)photonSeed, reflection_limit, (int)sizeof(real),
+    nrCaustics > 0,     //--  caustics left out of photonStore
+    russianRoulette, photonSampler
+  };
+  const double light[3] = { Light[0], Light[1], Light[2] };
+  h = fnvHash(opts,  sizeof(opts),  h);
+  h = fnvHash(&photonFirst, sizeof(photonFirst), h);
+  h = fnvHash(light, sizeof(light), h);
+  return h;
+}
+
+bool
+preparePhotons()
+{
+  StatCount t0 = statClock();
+  const unsigned long long key = photonKey();
+  if (photonKeyValid && photonKeyStored == key) {
+    finishEmission(t0);
+    return true;
+  }
+
+  //--  cache files for single emissions only (not for the passes of SPPM)
+  char path[1024] = "";
+  if (photonCache && photonFirst == 0) {
+    snprintf(path, sizeof(path), "%s/photons_%016llx.pmap", photonCache, key);
+  }
+
+  bool loaded = false;
+  if (path[0] && photonStore.loadBinary(path, key) && photonStore.numRanges() == nrObjects) {
+    //--  balanced already : the kd-trees are views on the mapped file
+    photonMaps.resize(nrObjects);
+    for (int id = 0; id < nrObjects; id++) {
+      photonMaps[id].attach(&photonStore, photonStore.rangeBegin(id), photonStore.rangeEnd(id));
+    }
+    precomputeIrradiance();
+    emitCaustics();
+    photonPaths.valid = false;
+    finishEmission(t0);
+    loaded = true;
+  } else {
+    emitPhotons();
+    //--  written aside and renamed : readers never map a partial file
+    if (path[0]) {
+      char tmp[1100];
+      snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+      if (!photonStore.saveBinary(tmp, key) || rename(tmp, path) != 0) {
+        unlink(tmp);
+        fprintf(stderr, "cannot write the photon cache %s\n", path);
+      }
+    }
+  }
+  photonKeyValid  = true;
+  photonKeyStored = key;
+  return loaded;
+}
+
+void
+invalidatePhotons(const float *bmin, const float *bmax)
+{
+  if (!photonPaths.valid) return;
+  //--  padded : paths are kept in float
+  for (int k = 0; k < 3; k++) photonPaths.dirty.push_back(bmin[k] - 1.0e-3f);
+  for (int k = 0; k < 3; k++) photonPaths.dirty.push_back(bmax[k] + 1.0e-3f);
+}
+
+//--  slab test of the segment p0 -> p1 against a box
+static bool
+segmentHitsBox(const float *p0, const float *p1, const float *box)
+{
+  float t0 = 0.0f, t1 = 1.0f;
+  for (int k = 0; k < 3; k++) {
+    float d = p1[k] - p0[k];
+    if (d == 0.0f) {
+      if (p0[k] < box[k] || p0[k] > box[3 + k]) return false;
+      continue;
+    }
+    float ta = (box[k]     - p0[k]) / d;
+    float tb = (box[3 + k] - p0[k]) / d;
+    if (ta > tb) std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    if (t0 > t1) return false;
+  }
+  return true;
+}
+
+int
+refreshPhotons()
+{
+  const int num_photon = nrPhotons * photonScale;
+  if (!photonPaths.valid          || photonPaths.num != num_photon ||
+      photonPaths.seed != photonSeed || photonPaths.stream != photonFirst ||
+      photonPaths.bounces != nrBounces || photonPaths.objects != nrObjects ||
+      photonPaths.caustics != (nrCaustics > 0) || photonPaths.roulette != russianRoulette ||
+      photonPaths.sampler != photonSampler ||
+      distance(photonPaths.light, Light) != 0.0) {
+    return preparePhotons() ? 0 : num_photon;
+  }
+  if (photonPaths.dirty.empty()) return 0;
+
+  StatCount t0 = statClock();
+  photonKeyValid = false;
+
+  //--  photons with a segment in any box of a moved object
+  std::vector<int> ids;
+  const int nbox = photonPaths.dirty.size() / 6;
+  for (int i = 0; i < num_photon; i++) {
+    bool hit = false;
+    for (int s = photonPaths.segFirst[i]; s < photonPaths.segFirst[i + 1] && !hit; s++) {
+      const float *seg = &photonPaths.segs[6 * s];
+      for (int b = 0; b < nbox && !hit; b++) {
+        hit = segmentHitsBox(seg, seg + 3, &photonPaths.dirty[6 * b]);
+      }
+    }
+    if (hit) ids.push_back(i);
+  }
+
+  SEmitJob job;
+  runEmitJob(job, tracePhoton, photonSampler, 0, ids.empty() ? NULL : &ids[0], ids.size(), true);
+
+  //--  objects that lose or gain photons : their kd-trees are rebuilt
+  std::vector<char> changed(nrObjects, photonCapacity > 0);
+  for (size_t k = 0; k < ids.size(); k++) {
+    const CPhotonStore &op = *photonPaths.store;
+    for (int j = photonPaths.first[ids[k]]; j < photonPaths.first[ids[k] + 1]; j++) changed[op.obj[j]] = 1;
+    const CPhotonStore &np = *job.stores[job.itemThread[k]];
+    for (int j = job.itemBegin[k]; j < job.itemEnd[k]; j++) changed[np.obj[j]] = 1;
+  }
+  updatePaths(job, ids.empty() ? NULL : &ids[0], ids.size(), num_photon);
+  freeEmitJob(job);
+
+  CPhotonStore old;
+  old.swap(photonStore);
+  storePaths();
+  finishEmission(t0);
+  updatePhotonMaps(old, changed);
+  emitCaustics();
+  return ids.size();
+}
+
+void
+buildPhotonMaps()
+{
+  StatCount t0 = statClock();
+  //--  one contiguous range and kd-tree per object
+  photonStore.sortByObject(nrObjects);
+  photonMaps.resize(nrObjects);
+  for (int id = 0; id < nrObjects; id++) {
+    photonMaps[id].build(&photonStore,
+        photonStore.rangeBegin(id), photonStore.rangeEnd(id), numThreads());
+  }
+  statAdd(STAT_TIME_PHOTONMAP, statClock() - t0);
+  precomputeIrradiance();
+}
+
+void
+storePhoton(CPhotonStore &st, CObj *ob, const Vector3 &location, const Vector3 &direction, const Vector3 &energy){
+  //--  into a thread buffer (no capacity) : counted when it is merged
+  st.store(ob->getIndex(), location, direction, energy);
+}
+
+void
+shadowPhoton(CPhotonStore &st, const Vector3 &ray, const Vector3 &pnt, std::vector<float> *segs,
+    float weight){
+  Vector3 shadow (-0.25,-0.25,-0.25);
+  shadow = shadow * weight;
+
+  //Start Just Beyond Last Intersection
+  Vector3 bumpedPoint = pnt + ray * 1.0e-5;
+
+  //Trace to Next Intersection (In Shadow)
+  statAdd(STAT_RAY_PHOTON);
+  SIntersectionStat istat = raytrace(ray, bumpedPoint);
+  recordSegment(segs, bumpedPoint, ray, istat.dist);
+  if(istat.dist >= NOT_INTERSECTED) { return; }
+
+  //3D Point
+  Vector3 shadowPoint = bumpedPoint + ray * istat.dist;
+
+  storePhoton(st, istat.obj, shadowPoint, ray, shadow);
+}
+
+Vector3
+mulColor(const Vector3 &rgbIn, CObj *ob)
+{
+  //--  Specifies Material Color of Each Object
+  const float *color = scene.material[ob->getIndex()].color;
+  return mul(Vector3(color), rgbIn);
+}
+CObj *
+addObject(int type, const float *cod)
+{
+  //--  view and arrays stay in step : object index == scene index
+  objects.push_back(CObj(scene.add(type, cod)));
+  nrObjects++;
+  return &objects.back();
+}
+
+void initObje() {
+  //--  color literal
+  static const float white[3] = {1.0,1.0,1.0};
+  static const float red[3]   = {1.0,0.0,0.0};
+  static const float green[3] = {0.0,1.0,0.0};
+  static const float blue[3]  = {0.0,0.0,1.0};
+
+  float v_sphere[][4] = {
+    //-- {center(x,y,z), radius}
+    { 1.0,  0.0, 4.0, 0.3},
+    {-0.6,  0.3, 4.5, 0.3},
+    { 0.0, -0.8, 4.0, 0.5},
+  };
+
+  float v_plane[][2]  = {
+    //--  {(axis_id), (distance_from_origin)}
+    //--  axis_id = 0:X, 1:Y, 2:Z
+    {0,  1.5},
+    {1, -1.5},
+    {0, -1.5},
+    {1,  1.5},
+    {2,  5.0}
+  };
+
+  //--  cleate objects and register them
+  objects.clear();
+  scene.clear();
+  nrObjects = 0;
+
+  //--  cleate spheres
+  for(int i=0; i<3; i++) {
+    addObject(TYPE_SPHERE, v_sphere[i]);
+  }
+
+  //--  cleate planes
+  for(int i=0; i<5; i++) {
+    addObject(TYPE_PLANE, v_plane[i]);
+  }
+
+  //--  set optical properties
+  objects[1].setOptics(OPT_REFLECT);
+  objects[2].setOptics(OPT_REFRACT);
+  objects[2].setRefractive(2.5f);
+
+  objects[4].setColor(green);
+  objects[6].setColor(red);
+
+  buildAccel();
+}
+
+void
+addRandomSpheres(int num, unsigned int seed)
+{
+  //--  small diffuse spheres scattered inside the room (benchmark scenes)
+  CRandom rng(seed, 0);
+  for (int i = 0; i < num; i++) {
+    float radius = 0.02 + 0.06 * rng.uniform();
+    float v[4] = {
+      (float)(-1.4 + 2.8 * rng.uniform()),
+      (float)(-1.4 + 2.6 * rng.uniform()),
+      (float)( 2.0 + 2.9 * rng.uniform()),
+      radius
+    };
+    float cl[3] = {
+      (float)(0.3 + 0.7 * rng.uniform()),
+      (float)(0.3 + 0.7 * rng.uniform()),
+      (float)(0.3 + 0.7 * rng.uniform())
+    };
+    addObject(TYPE_SPHERE, v)->setColor(cl);
+  }
+  buildAccel();
+}
+
+CObj *
+addMesh(CMesh *ms, const float *center, float size)
+{
+  //--  largest extent -> size, box center -> center
+  float bmin[3], bmax[3];
+  ms->getBounds(bmin, bmax);
+  float extent = std::max(bmax[0] - bmin[0], std::max(bmax[1] - bmin[1], bmax[2] - bmin[2]));
+  float scale  = (extent > 0.0f) ? size / extent : 1.0f;
+
+  float v[4];
+  for (int i = 0; i < 3; i++) v[i] = center[i] - 0.5f * (bmin[i] + bmax[i]) * scale;
+  v[3] = scale;
+
+  addObject(TYPE_TRIANGLE, v)->setMesh(ms);
+  meshes.push_back(ms);
+  buildAccel();
+  return &objects.back();
+}
+
+CObj *
+loadMesh(const char *path, const float *center, float size)
+{
+  CMesh *ms = new CMesh();
+  if (!ms->load(path)) {
+    delete ms;
+    return NULL;
+  }
+  return addMesh(ms, center, size);
+}
+
+void
+freeObje() {
+  objects.clear();
+  scene.clear();
+  for(size_t i=0; i<meshes.size(); i++) { delete meshes[i]; }
+  meshes.clear();
+  nrObjects = 0;
+  buildAccel();
+}
+
+
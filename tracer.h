@@ -0,0 +1,177 @@
+//tracer.h
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#include <vector>
+#include "object.h"
+#include "photonmap.h"
+#include "rng.h"
+#include "sampler.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "stats.h"
+
+// ----- Scene Description -----
+extern int szImg;           //--  rendering screen size
+extern int nrTypes;         //--  object tpye = 0:SPHERE, 1:PLANE, 2:TRIANGLE
+extern int nrObjects;       //--  num of object
+
+extern std::vector<CObj> objects;   //--  views on the scene arrays
+extern std::vector<CMesh*> meshes;   //--  owned, shared by TYPE_TRIANGLE objects
+extern Vector3       Light;       //--  Point Light-Source Position
+extern const float   lightRadius; //--  photons start below Light, within this distance
+extern const Vector3 gOrigin;     //--  Camera Position
+extern const int reflection_limit; //--  reflections and refractions followed per path
+
+// ----- Acceleration -----
+//--  BVH over the bounded objects (spheres), planes are tested linearly
+extern CBvh  sceneBvh;
+extern std::vector<int> boundedIds;  //--  BVH primitive -> object index
+extern std::vector<int> planeIds;    //--  unbounded objects
+extern bool  useBvh;        //--  false : linear loop over all objects
+extern int   bvhMinObjects; //--  fewer bounded objects : linear loop
+
+// ----- Photon Mapping -----
+extern int   nrPhotons;     //--  Number of Photons Emitted
+extern int   nrBounces;     //--  Number of Times Each Photon Bounces
+extern bool  russianRoulette; //--  Terminate Photons by the Power They Keep
+extern int   photonSampler; //--  Random Numbers of the Photons (SAMPLER_*)
+extern bool  lightPhotons;  //--  Enable Photon Lighting?
+extern float exposure;      //--  Number of Photons Integrated at Brightest Pixel
+extern float photonScale;   //--  Emission Multiplier (Photon View)
+extern int   photonCapacity;//--  Max Num of Stored Photons (0 : unlimited)
+extern unsigned int photonSeed; //--  Seed of the Photon Random Streams
+extern uint64_t     photonFirst;//--  Stream of the First Photon Emitted (passes)
+//--  random streams (CSampler index) : the family in the top 16 bits,
+//--  photonFirst + photon index below 2^48 (the photons of emitPhotons())
+static const uint64_t stream_caustic = 1ULL << 48;   //--  emitCaustics()
+static const uint64_t stream_shadow  = 2ULL << 48;   //--  emitShadowPhotons()
+extern const char  *photonCache;//--  Directory of the Photon Map Files (NULL : none)
+extern const float sqRadius;    //--  Photon Gather Radius (a distance)
+extern bool  trackPhotonPaths;  //--  Keep the Photon Paths for refreshPhotons()
+
+//--  photons of all objects, contiguous per object after emission
+extern CPhotonStore photonStore;
+//--  kd-tree over each object's photon range, built after emission
+extern std::vector<CPhotonMap> photonMaps;
+extern bool       usePhotonMap;  //--  false : linear scan in gatherPhotons()
+extern bool  usePrecomputed;     //--  gatherPhotons() : nearest precomputed estimate
+extern int   precomputeStep;     //--  every nth photon of an object gets an estimate
+extern int   precomputeMax;      //--  max num of estimates : larger steps beyond
+
+//--  called for every stored photon (visualization), may be NULL
+extern void (*photonHook)(const Vector3 &rgb, const Vector3 &p);
+
+
+/**functions**/
+
+//--  prim : hit triangle for meshes, 0 otherwise
+real    rayObject(CObj *ob, const Vector3 &r, const Vector3 &o, int &prim);
+Vector3 surfaceNormal(const SIntersectionStat &hit, const Vector3 &P, const Vector3 &Inside);
+//--  diffuse light from Light at P, at least lightAmbient (not in shadow)
+float   lightObject(const SIntersectionStat &hit, const Vector3 &P, float lightAmbient);
+
+SIntersectionStat raytrace(const Vector3 &ray, const Vector3 &origin);
+SIntersectionStat raytraceLinear(const Vector3 &ray, const Vector3 &origin);
+//--  any object but skip hit with 1e-5 < t < tmax (t in units of ray, as
+//--  in raytrace()); stops at the first hit found, spheres before walls
+bool    occluded(const Vector3 &ray, const Vector3 &origin, real tmax, const CObj *skip = NULL);
+//--  closest-hit rule of raytrace() : nearest hit beyond 1e-5, on equal
+//--  distances the lower object index (the first one of the linear loop)
+inline bool
+closerHit(const SIntersectionStat &istat, real dist, CObj *ob)
+{
+  if (dist <= 1.0e-5 || dist >= NOT_INTERSECTED) return false;
+  if (dist < istat.dist) return true;
+  return dist == istat.dist && ob->getIndex() < istat.obj->getIndex();
+}
+//--  (re)build the BVH after objects were added or removed
+void    buildAccel();
+//--  update the BVH boxes after objects moved
+void    refitAccel();
+Vector3 primaryRay(float x, float y);
+Vector3 calcPixelColor(float x, float y);
+//--  rest of calcPixelColor() once the primary ray from gOrigin is traced
+Vector3 shadePixel(const Vector3 &primary, const SIntersectionStat &hit);
+//--  follow mirrors and glass from the primary hit to the surface that is lit
+//--  false if the path leaves the scene
+bool    visiblePoint(const Vector3 &primary, const SIntersectionStat &hit,
+    Vector3 &pnt, SIntersectionStat &istat);
+//--  colour of the visible point pnt on istat.obj (the rest of shadePixel())
+Vector3 lightPoint(const Vector3 &pnt, const SIntersectionStat &istat);
+
+Vector3 reflect(
+    const SIntersectionStat &hit,
+    const Vector3 &point,
+    const Vector3 &ray,
+    const Vector3 &fromPoint);
+Vector3 refract(
+    const SIntersectionStat &hit,
+    const Vector3 &point,
+    const Vector3 &ray,
+    const Vector3 &fromPoint,
+    float &ref);
+
+Vector3 gatherPhotons(const Vector3 &p, const SIntersectionStat &hit);
+Vector3 gatherPhotonsLinear(const Vector3 &p, const SIntersectionStat &hit);
+void    emitPhotons();
+//--  hash of the scene, the light and the emission options : same key,
+//--  same photons
+unsigned long long photonKey();
+//--  emitPhotons() unless photonStore already holds the photons of
+//--  photonKey() or they can be mapped from photonCache (then true)
+//--  new emissions are written to photonCache
+bool    preparePhotons();
+//--  objects that moved since the last emission : their old and new boxes
+//--  (paths are only kept while trackPhotonPaths is on)
+void    invalidatePhotons(const float *bmin, const float *bmax);
+//--  same photons as emitPhotons(), retracing only the paths that cross an
+//--  invalidated box; a full emission if the light, the emission options or
+//--  the object count changed (materials are assumed unchanged)
+//--  returns the num of photons traced
+int     refreshPhotons();
+//--  origin and direction of a photon (the first dimensions of its
+//--  sampler); false if it starts outside the room or inside a sphere
+bool    startPhoton(CSampler &smp, Vector3 &from, Vector3 &ray);
+//--  segs : ray segments of the path are appended (6 floats each), may be NULL
+void    emitPhoton(CSampler &smp, CPhotonStore &st, std::vector<float> *segs = NULL);
+//--  one photon of an emission from its sampler, stored into st (a thread
+//--  buffer), segments appended to segs (may be NULL); returns a count that
+//--  the emission sums up
+typedef int (*PhotonFunc)(CSampler &smp, CPhotonStore &st, std::vector<float> *segs);
+//--  num photons through fn in chunks on the workers, photon i drawn from
+//--  the stream family + photonFirst + i of sampler (stream_*, 0 : those
+//--  of emitPhotons()), merged in photon order into dst : same photons for
+//--  any thread count, at most the capacity of dst (the rest dropped)
+//--  returns the sum of what fn returned
+long long emitPhotonsInto(CPhotonStore &dst, PhotonFunc fn, int sampler, uint64_t family, int num);
+//--  kd-trees of the photon maps, then precomputeIrradiance()
+void    buildPhotonMaps();
+//--  irradiance estimates at every precomputeStep-th photon (with the
+//--  surface normal) for usePrecomputed; cleared when usePrecomputed is off
+void    precomputeIrradiance();
+//--  into a thread buffer; STAT_PHOTON_STORED and STAT_PHOTON_DROPPED are
+//--  counted when the buffers are merged (photonCapacity applies there)
+void    storePhoton(CPhotonStore &st, CObj *ob,
+    const Vector3 &location,
+    const Vector3 &direction,
+    const Vector3 &energy );
+//--  weight : 1 / probability of reaching pnt (Russian roulette)
+void    shadowPhoton(CPhotonStore &st, const Vector3 &ray, const Vector3 &pnt,
+    std::vector<float> *segs = NULL, float weight = 1.0f);
+
+Vector3 mulColor(const Vector3 &rgbIn, CObj *ob);
+
+//--  new object in the scene arrays (cod as in SScene::add())
+//--  the pointer is valid until the next object is added
+CObj *addObject(int type, const float *cod);
+void initObje();
+//--  num extra spheres at random places in the room
+void addRandomSpheres(int num, unsigned int seed);
+//--  mesh instance scaled to fit size, its box centered at center (takes ms)
+CObj *addMesh(CMesh *ms, const float *center, float size);
+//--  OBJ or .pmesh file through addMesh(), NULL if it cannot be loaded
+CObj *loadMesh(const char *path, const float *center, float size);
+void freeObje();
+
+#endif // __TRACER_H__
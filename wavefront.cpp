@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tracer.h"
+#include "renderer.h"
+#include "packet.h"
+#include "wavefront.h"
+
+bool useWavefront = false;  //--  trace reflections, refractions and photon bounces a generation at a time
+
+CWaveQueue::CWaveQueue(int capacity)
+{
+  rays   .reserve(capacity);
+  origins.reserve(capacity);
+  items  .reserve(capacity);
+  hits   .resize(capacity);
+  order  .reserve(capacity);
+}
+
+int
+CWaveQueue::push(const Vector3 &ray, const Vector3 &origin, int item)
+{
+  rays   .push_back(ray);
+  origins.push_back(origin);
+  items  .push_back(item);
+  return items.size() - 1;
+}
+
+//--  cell of v in [lo, hi] out of 16
+static inline uint32_t
+cellOf(double v, double lo, double scale)
+{
+  int c = (int)((v - lo) * scale);
+  return std::max(0, std::min(15, c));
+}
+
+uint32_t
+CWaveQueue::coherenceKey(int i, const double *box) const
+{
+  const Vector3 &d = rays[i];
+  const Vector3 &o = origins[i];
+  //--  octant first : rays of one octant visit the BVH children in one
+  //--  order, then the major axis of the direction (a face of the cube)
+  uint32_t key = 0;
+  for (int k = 0; k < 3; k++) key = key << 1 | (d[k] < 0.0);
+  const double ax = fabs(d[0]), ay = fabs(d[1]), az = fabs(d[2]);
+  key = key << 2 | (ax >= ay && ax >= az ? 0 : ay >= az ? 1 : 2);
+  for (int k = 0; k < 3; k++) key = key << 4 | cellOf(o[k], box[k], box[6 + k]);
+  return key;
+}
+
+void
+CWaveQueue::trace()
+{
+  const int num = size();
+  if ((int)hits.size() < num) hits.resize(num);
+
+  //--  box of the origins : the cells of the key follow the rays
+  //--  (low corner, high corner, 16 / extent)
+  double box[9] = { HUGE_VAL, HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+  for (int i = 0; i < num; i++) {
+    for (int k = 0; k < 3; k++) {
+      box[k]     = std::min(box[k],     (double)origins[i][k]);
+      box[3 + k] = std::max(box[3 + k], (double)origins[i][k]);
+    }
+  }
+  for (int k = 0; k < 3; k++) box[6 + k] = box[3 + k] > box[k] ? 16.0 / (box[3 + k] - box[k]) : 0.0;
+  order.clear();
+  for (int i = 0; i < num; i++) order.push_back((uint64_t)coherenceKey(i, box) << 32 | i);
+  std::sort(order.begin(), order.end());
+
+  if (!usePackets) {
+    for (int k = 0; k < num; k++) {
+      const int i = order[k] & 0xffffffffu;
+      hits[i] = raytrace(rays[i], origins[i]);
+    }
+    return;
+  }
+
+  SRayPacket        rp;
+  SIntersectionStat istat[PACKET_SIZE];
+  for (int k = 0; k < num; k += PACKET_SIZE) {
+    rp.num = std::min(PACKET_SIZE, num - k);
+    //--  rays of different keys part ways in the BVH : a packet would take
+    //--  every lane through the nodes of all of them (photon bounces mostly)
+    if (order[k] >> 32 != order[k + rp.num - 1] >> 32) {
+      for (int l = 0; l < rp.num; l++) {
+        const int i = order[k + l] & 0xffffffffu;
+        hits[i] = raytrace(rays[i], origins[i]);
+      }
+      continue;
+    }
+    for (int l = 0; l < rp.num; l++) {
+      const int i = order[k + l] & 0xffffffffu;
+      setPacketRay(rp, l, rays[i], origins[i]);
+    }
+    raytracePacket(rp, istat);
+    for (int l = 0; l < rp.num; l++) hits[order[k + l] & 0xffffffffu] = istat[l];
+  }
+}
@@ -0,0 +1,47 @@
+//wavefront.h
+#ifndef __WAVEFRONT_H__
+#define __WAVEFRONT_H__
+
+#include <stdint.h>
+#include <vector>
+#include "object.h"
+
+extern bool useWavefront;   //--  trace reflections, refractions and photon bounces a generation at a time
+
+//--  rays of one generation (the secondary rays of a tile, the bounces of
+//--  a chunk of photons), traced together : sorted by direction and origin
+//--  so that neighbours in the order take the same paths through the BVH,
+//--  then PACKET_SIZE rays of one key at a time through raytracePacket()
+//--  (raytrace() one by one for mixed keys, or without usePackets)
+//--  the hits stay in push order : the caller goes through its rays (and
+//--  its stores) in the order of the depth-first tracer
+class CWaveQueue {
+  public :
+    //--  no allocation below capacity rays
+    CWaveQueue(int capacity);
+
+    void    clear() { rays.clear(); origins.clear(); items.clear(); }
+    //--  item : what the ray belongs to (pixel, photon), returns its index
+    int     push(const Vector3 &ray, const Vector3 &origin, int item);
+    int     size() const { return items.size(); }
+
+    //--  closest hit of every ray, same as raytrace() on each
+    void    trace();
+
+    const Vector3 &ray(int i)    const { return rays[i]; }
+    const Vector3 &origin(int i) const { return origins[i]; }
+    int     item(int i) const { return items[i]; }
+    const SIntersectionStat &hit(int i) const { return hits[i]; }
+
+  private :
+    //--  direction octant and major axis, then origin cell within box
+    uint32_t coherenceKey(int i, const double *box) const;
+
+    std::vector<Vector3> rays;
+    std::vector<Vector3> origins;
+    std::vector<int>     items;
+    std::vector<SIntersectionStat> hits;
+    std::vector<uint64_t> order;      //--  key << 32 | index
+};
+
+#endif // __WAVEFRONT_H__